@@ -0,0 +1,126 @@
+// Latency of "path P as of commit N" against the checkpoint interval K: each lookup runs in a
+// fresh codekeeper::Repository, as a CLI call would, so nothing is cached in memory but the OS
+// page cache is warm. K = 0 writes no checkpoints, which leaves the history index (a read of
+// the whole log) to answer: that is the baseline. Every K must give the same answers as it.
+//
+// The repository is built once in a temporary directory: --files files in a small directory
+// tree, imported, then --commits commits of one or a few rewritten files each. For each K,
+// .checkpoints is rebuilt and --queries random (commit, path) pairs are looked up.
+//
+// g++ -std=c++17 -O2 -I. -o build/bench-checkpoints bench/checkpoint-latency.cpp libcodekeeper.cpp -lssl -lcrypto -lpthread
+// ./build/bench-checkpoints [--commits N] [--files N] [--intervals 0,16,64,...] [--queries N] [--json]
+
+#include "libcodekeeper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+void writeFile(const fs::path& path, const std::string& text) {
+    std::ofstream out(path, std::ios::binary);
+    out << text;
+}
+
+int main(int argc, char* argv[]) {
+    size_t commits = 10000, files = 2000, queries = 200;
+    std::vector<size_t> intervals = {0, 16, 64, 256, 1024, 4096};
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") json = true;
+        else if (arg == "--commits" && i + 1 < argc) commits = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--files" && i + 1 < argc) files = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--queries" && i + 1 < argc) queries = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--intervals" && i + 1 < argc) {
+            intervals.clear();
+            std::stringstream list(argv[++i]);
+            std::string k;
+            while (std::getline(list, k, ',')) intervals.push_back(std::strtoul(k.c_str(), nullptr, 10));
+        }
+    }
+
+    fs::path dir = fs::temp_directory_path() / ("codekeeper-bench-checkpoints-" + std::to_string(getpid()));
+    fs::create_directories(dir / "versions");
+    writeFile(dir / "commit_log.txt", "");
+    fs::current_path(dir);
+    std::vector<std::string> paths;
+    for (size_t f = 0; f < files; ++f) {
+        fs::path p = dir / ("dir_" + std::to_string(f % 16)) / ("sub_" + std::to_string(f / 16 % 8)) /
+                     ("file_" + std::to_string(f) + ".txt");
+        fs::create_directories(p.parent_path());
+        writeFile(p, "file " + std::to_string(f) + "\n");
+        paths.push_back(p.string());
+    }
+
+    // History, with checkpoints off while it is written; every K gets them rebuilt below
+    writeFile(dir / ".checkpoint_interval", "0\n");
+    std::mt19937_64 rng(7);
+    auto start = std::chrono::steady_clock::now();
+    {
+        codekeeper::Repository repo(dir);
+        repo.commit(paths, "Initial import");
+        for (size_t c = 1; c < commits; ++c) {
+            std::vector<std::string> changed;
+            for (size_t k = 0, count = 1 + rng() % 3; k < count; ++k) {
+                const std::string& p = paths[rng() % paths.size()];
+                writeFile(p, "commit " + std::to_string(c) + "\n");
+                changed.push_back(p);
+            }
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            repo.commit(changed, "Change " + std::to_string(c));
+        }
+    }
+    double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!json) printf("%zu commits over %zu files built in %.1f s\n", commits, files, buildSeconds);
+
+    std::vector<std::pair<size_t, std::string>> lookups;
+    for (size_t q = 0; q < queries; ++q) lookups.emplace_back(rng() % commits, paths[rng() % paths.size()]);
+    std::vector<std::string> expected;
+
+    int status = 0;
+    for (size_t interval : intervals) {
+        writeFile(dir / ".checkpoint_interval", std::to_string(interval) + "\n");
+        codekeeper::Repository(dir).rebuildCheckpoints();
+        std::vector<double> samples;
+        std::vector<std::string> answers;
+        for (const auto& [n, path] : lookups) {
+            auto begin = std::chrono::steady_clock::now();
+            codekeeper::Repository repo(dir);
+            codekeeper::Repository::TreeEntry entry;
+            bool found = repo.fileAsOf(path, n, entry);
+            samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+            answers.push_back(found ? entry.version : "");
+        }
+        if (expected.empty()) expected = answers;
+        else if (answers != expected) {
+            fprintf(stderr, "K=%zu: answers differ from the first interval's\n", interval);
+            status = 1;
+        }
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        double median = sorted[sorted.size() / 2];
+        double p95 = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+        if (json) {
+            std::string list;
+            for (double s : samples) list += (list.empty() ? "" : ",") + std::to_string(s);
+            printf("{\"scale\":%zu,\"op\":\"fileAsOf K=%zu\",\"ok\":%s,\"median_s\":%.6f,\"p95_s\":%.6f,\"samples\":[%s]}\n",
+                   commits, interval, status ? "false" : "true", median, p95, list.c_str());
+        } else {
+            printf("K=%-6zu %10.3f ms median %10.3f ms p95\n", interval, median * 1e3, p95 * 1e3);
+        }
+    }
+    fs::current_path(fs::temp_directory_path());
+    fs::remove_all(dir);
+    return status;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Puts two benchmark result files from bench/run-bench.sh side by side.
+#
+#   bench/compare.sh <baseline.jsonl> <candidate.jsonl>
+#
+# Prints the median time of every (scale, op) found in both files and the candidate/baseline
+# ratio; ratios above 1.10 are flagged as slower, below 0.90 as faster.
+
+set -e
+
+if [ $# -ne 2 ]; then
+    echo "Usage: bench/compare.sh <baseline.jsonl> <candidate.jsonl>" >&2
+    exit 1
+fi
+
+awk '
+    function field(line, name,    re, m) {
+        re = "\"" name "\":(\"[^\"]*\"|[^,}]*)"
+        if (!match(line, re)) return ""
+        m = substr(line, RSTART + length(name) + 3, RLENGTH - length(name) - 3)
+        gsub(/"/, "", m)
+        return m
+    }
+    FNR == 1 { file++ }
+    {
+        key = field($0, "scale") SUBSEP field($0, "op")
+        if (file == 1) { base[key] = field($0, "median_s"); baseVersion = field($0, "version") }
+        else { cand[key] = field($0, "median_s"); candVersion = field($0, "version"); order[++n] = key }
+    }
+    END {
+        printf "%-10s %-24s %14s %14s %8s\n", "scale", "op", baseVersion, candVersion, "ratio"
+        for (i = 1; i <= n; i++) {
+            key = order[i]
+            if (!(key in base)) continue
+            split(key, k, SUBSEP)
+            ratio = base[key] > 0 ? cand[key] / base[key] : 0
+            note = ratio > 1.10 ? "  slower" : (ratio < 0.90 && ratio > 0 ? "  faster" : "")
+            printf "%-10s %-24s %13.4fs %13.4fs %8.2f%s\n", k[1], k[2], base[key], cand[key], ratio, note
+        }
+    }
+' "$1" "$2"
@@ -0,0 +1,139 @@
+// Diff engine on large text files: time for codekeeper::diffLines and the size of the result,
+// next to the line-lockstep comparison the old merge-files did (line i against line i).
+// Lockstep reports every line after the first insertion as changed, so the "changed" columns
+// show how much conflict noise a merge of the same pair would have produced.
+//
+// With two files, those are compared. Without, a ~100k-line text is built from the repository's
+// own sources (see synthesize) and a copy of it gets scattered inserts, deletes and rewrites.
+//
+// g++ -std=c++17 -O2 -I. -o build/bench-diff bench/diff-large.cpp libcodekeeper.cpp -lssl -lcrypto -lpthread
+// ./build/bench-diff [<old> <new>] [--lines N] [--edits N] [--repeat N] [--json]
+
+#include "libcodekeeper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+std::string readAll(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Repository sources repeated up to `lines` lines, then an edited copy
+void synthesize(size_t lines, size_t edits, std::string& oldText, std::string& newText) {
+    std::vector<std::string> pool;
+    for (const char* name : {"codekeeper.cpp", "codekeeper-web.cpp", "libcodekeeper.cpp", "libcodekeeper.h"}) {
+        std::string text = readAll(name);
+        for (auto line : codekeeper::splitLines(text)) {
+            pool.emplace_back(line);
+            if (pool.back().back() != '\n') pool.back() += '\n';
+        }
+    }
+    if (pool.empty()) pool.push_back("placeholder line\n");
+    // Repeats of the sources get a third of their lines tagged with the pass number: text that
+    // repeats wholesale many times over would make histogram diff pair up the wrong copies (git's
+    // does the same), which real files rarely ask of it
+    std::mt19937_64 rng(42);
+    std::vector<std::string> a;
+    for (size_t i = 0; a.size() < lines; ++i) {
+        std::string line = pool[i % pool.size()];
+        size_t pass = i / pool.size();
+        if (pass > 0 && rng() % 3 == 0) {
+            if (!line.empty() && line.back() == '\n') line.pop_back();
+            line += " // " + std::to_string(pass) + "\n";
+        }
+        a.push_back(line);
+    }
+
+    std::vector<std::string> b = a;
+    for (size_t e = 0; e < edits && !b.empty(); ++e) {
+        size_t at = rng() % b.size();
+        size_t span = 1 + rng() % 8;
+        switch (rng() % 3) {
+        case 0:
+            for (size_t i = 0; i < span; ++i) b.insert(b.begin() + at, "// inserted " + std::to_string(e) + "\n");
+            break;
+        case 1:
+            b.erase(b.begin() + at, b.begin() + std::min(b.size(), at + span));
+            break;
+        default:
+            for (size_t i = at; i < std::min(b.size(), at + span); ++i) b[i] = "    rewritten(" + std::to_string(e) + ");\n";
+        }
+    }
+    for (const auto& line : a) oldText += line;
+    for (const auto& line : b) newText += line;
+}
+
+size_t lockstepChanged(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b) {
+    size_t changed = 0;
+    for (size_t i = 0; i < std::max(a.size(), b.size()); ++i) {
+        if (i >= a.size() || i >= b.size() || a[i] != b[i]) ++changed;
+    }
+    return changed;
+}
+
+int main(int argc, char* argv[]) {
+    size_t lines = 100000, edits = 200;
+    int repeat = 5;
+    bool json = false;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") json = true;
+        else if (arg == "--lines" && i + 1 < argc) lines = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--edits" && i + 1 < argc) edits = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--repeat" && i + 1 < argc) repeat = std::max(1, std::atoi(argv[++i]));
+        else files.push_back(arg);
+    }
+
+    std::string oldText, newText;
+    if (files.size() == 2) {
+        oldText = readAll(files[0]);
+        newText = readAll(files[1]);
+    } else {
+        synthesize(lines, edits, oldText, newText);
+    }
+    auto a = codekeeper::splitLines(oldText);
+    auto b = codekeeper::splitLines(newText);
+
+    std::vector<double> samples;
+    size_t changed = 0;
+    for (int r = 0; r < repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        auto chunks = codekeeper::diffLines(a, b);
+        samples.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        changed = 0;
+        for (const auto& c : chunks) changed += std::max(c.aCount, c.bCount);
+    }
+    auto start = std::chrono::steady_clock::now();
+    size_t lockstep = lockstepChanged(a, b);
+    double lockstepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(samples.begin(), samples.end());
+    double median = samples[samples.size() / 2];
+    if (json) {
+        std::string list;
+        for (double s : samples) list += (list.empty() ? "" : ",") + std::to_string(s);
+        printf("{\"scale\":%zu,\"op\":\"diffLines\",\"ok\":true,\"median_s\":%.6f,\"samples\":[%s],\"changed\":%zu}\n",
+               a.size(), median, list.c_str(), changed);
+        printf("{\"scale\":%zu,\"op\":\"diff lockstep\",\"ok\":true,\"median_s\":%.6f,\"samples\":[%.6f],\"changed\":%zu}\n",
+               a.size(), lockstepSeconds, lockstepSeconds, lockstep);
+    } else {
+        printf("%zu -> %zu lines\n", a.size(), b.size());
+        printf("%-10s %10.2f ms %10zu lines changed\n", "diffLines", median * 1e3, changed);
+        printf("%-10s %10.2f ms %10zu lines changed\n", "lockstep", lockstepSeconds * 1e3, lockstep);
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+// Synthetic repository generator for the benchmark suite (bench/run-bench.sh).
+//
+// Writes a working tree of text files spread over a directory tree, and optionally builds commit
+// history on top of it through libcodekeeper: each commit rewrites a `churn` fraction of the
+// files. Output is deterministic for a given --seed, so runs of different versions see the same
+// repository. File names are unique across the tree because staging and versions/ are keyed by
+// file name.
+//
+// g++ -std=c++17 -O2 -I. -o build/gen-repo bench/gen-repo.cpp libcodekeeper.cpp -lssl -lcrypto -lpthread
+// ./build/gen-repo <dir> [--files N] [--depth D] [--fanout F] [--size-dist SPEC]
+//                        [--commits C] [--churn R] [--seed S]
+//
+// SPEC is fixed:<bytes>, uniform:<min>:<max> or lognormal:<median>[:<sigma>]; sizes are capped
+// at 1 MiB. History (--commits > 0) needs an initialized repository: codekeeper init <name> --local.
+
+#include "libcodekeeper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct Options {
+    fs::path dir;
+    size_t files = 1000;
+    size_t depth = 3;
+    size_t fanout = 8;
+    std::string sizeDist = "lognormal:2048";
+    size_t commits = 0;
+    double churn = 0.01;
+    uint64_t seed = 1;
+};
+
+constexpr size_t kMaxFileSize = 1 << 20;
+
+class SizeDistribution {
+public:
+    explicit SizeDistribution(const std::string& spec) {
+        auto parts = codekeeper::split(spec, ':');
+        if (parts.empty()) throw std::runtime_error("empty size distribution");
+        kind_ = parts[0];
+        if (kind_ == "fixed" && parts.size() == 2) {
+            a_ = std::stod(parts[1]);
+        } else if (kind_ == "uniform" && parts.size() == 3) {
+            a_ = std::stod(parts[1]);
+            b_ = std::stod(parts[2]);
+            if (b_ < a_) throw std::runtime_error("uniform: max is below min");
+        } else if (kind_ == "lognormal" && (parts.size() == 2 || parts.size() == 3)) {
+            a_ = std::log(std::stod(parts[1]));
+            b_ = parts.size() == 3 ? std::stod(parts[2]) : 1.0;
+        } else {
+            throw std::runtime_error("bad size distribution: " + spec);
+        }
+    }
+
+    size_t operator()(std::mt19937_64& rng) const {
+        double size;
+        if (kind_ == "fixed") size = a_;
+        else if (kind_ == "uniform") size = std::uniform_real_distribution<double>(a_, b_)(rng);
+        else size = std::lognormal_distribution<double>(a_, b_)(rng);
+        return std::min(kMaxFileSize, static_cast<size_t>(std::max(1.0, size)));
+    }
+
+private:
+    std::string kind_;
+    double a_ = 0, b_ = 0;
+};
+
+// Path of file i: `depth` directory levels picked from the seed-mixed index, then a unique name
+fs::path filePath(const Options& opt, size_t i) {
+    fs::path p = opt.dir;
+    uint64_t h = (i + 1) * 0x9e3779b97f4a7c15ull ^ opt.seed;
+    for (size_t d = 0; d < opt.depth; ++d) {
+        p /= "d" + std::to_string(d) + "_" + std::to_string(h % opt.fanout);
+        h = h / opt.fanout * 0xff51afd7ed558ccdull + d;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "file_%08zu.txt", i);
+    return p / name;
+}
+
+// Printable text in 64-byte lines, like the source files the tools are used on
+void writeFile(const fs::path& path, size_t size, std::mt19937_64& rng) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+    std::string content(size, ' ');
+    for (size_t i = 0; i < size; ++i)
+        content[i] = (i % 64 == 63) ? '\n' : alphabet[rng() % (sizeof(alphabet) - 1)];
+    content.back() = '\n';
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), content.size());
+    if (!out) throw std::runtime_error("could not write " + path.string());
+}
+
+void usage() {
+    std::cerr << "Usage: gen-repo <dir> [--files N] [--depth D] [--fanout F] [--size-dist SPEC]\n"
+                 "                      [--commits C] [--churn R] [--seed S]\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--files" && hasValue) opt.files = std::stoul(argv[++i]);
+            else if (arg == "--depth" && hasValue) opt.depth = std::stoul(argv[++i]);
+            else if (arg == "--fanout" && hasValue) opt.fanout = std::max(1ul, std::stoul(argv[++i]));
+            else if (arg == "--size-dist" && hasValue) opt.sizeDist = argv[++i];
+            else if (arg == "--commits" && hasValue) opt.commits = std::stoul(argv[++i]);
+            else if (arg == "--churn" && hasValue) opt.churn = std::stod(argv[++i]);
+            else if (arg == "--seed" && hasValue) opt.seed = std::stoull(argv[++i]);
+            else if (arg[0] != '-' && opt.dir.empty()) opt.dir = arg;
+            else { usage(); return 1; }
+        }
+    } catch (const std::exception&) {
+        usage();
+        return 1;
+    }
+    if (opt.dir.empty()) {
+        usage();
+        return 1;
+    }
+
+    try {
+        SizeDistribution sizes(opt.sizeDist);
+        std::mt19937_64 rng(opt.seed);
+        opt.dir = fs::absolute(opt.dir);
+        auto start = std::chrono::steady_clock::now();
+
+        // Working tree; files already present are left alone so history can be added later
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < opt.files; ++i) {
+            fs::path p = filePath(opt, i);
+            size_t size = sizes(rng);
+            if (fs::exists(p)) continue;
+            fs::create_directories(p.parent_path());
+            writeFile(p, size, rng);
+            bytes += size;
+        }
+
+        // History: an initial import when the log is empty, then churn commits
+        if (opt.commits > 0) {
+            if (!fs::exists(opt.dir / "commit_log.txt")) {
+                std::cerr << "Error: " << opt.dir.string() << " is not a repository. "
+                          << "Run 'codekeeper init <name> --local' there first.\n";
+                return 1;
+            }
+            auto repo = codekeeper::Repository::open(opt.dir);
+            size_t made = 0;
+            if (fs::file_size(repo->logPath()) == 0) {
+                repo->commit(codekeeper::collectFiles(opt.dir.string()), "Initial import");
+                ++made;
+            }
+            size_t perCommit = std::max<size_t>(1, static_cast<size_t>(opt.files * opt.churn));
+            for (; made < opt.commits; ++made) {
+                std::vector<std::string> changed;
+                for (size_t k = 0; k < perCommit; ++k) {
+                    fs::path p = filePath(opt, rng() % opt.files);
+                    size_t size = sizes(rng);
+                    writeFile(p, size, rng);
+                    bytes += size;
+                    changed.push_back(p.string());
+                }
+                std::sort(changed.begin(), changed.end());
+                changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+                repo->commit(changed, "Churn " + std::to_string(made));
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("{\"files\":%zu,\"commits\":%zu,\"bytes_written\":%llu,\"seconds\":%.3f}\n",
+               opt.files, opt.commits, static_cast<unsigned long long>(bytes), seconds);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
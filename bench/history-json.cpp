@@ -0,0 +1,157 @@
+// Compares the two ways of answering /api/history for a large log:
+//   tree    one json object per commit (the old cache), assembled and dump()ed into one string
+//   stream  CommitEntry cache written through JsonWriter into a 16 KiB buffer
+// Each mode runs in its own child process so peak RSS is measured separately, and both
+// outputs are checksummed to confirm they are byte-identical.
+//
+// g++ -std=c++17 -O2 -Iinclude -I. -o build/bench-history-json bench/history-json.cpp
+// ./build/bench-history-json [commits] [files-per-commit]
+
+#include "json.hpp"
+#include "codekeeper-json.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+struct CommitEntry {
+    std::string id;
+    std::string message;
+    std::string timestamp;
+    std::vector<std::string> files;
+};
+
+// Synthetic log tokens shaped like commit_log.txt lines split on '|'
+// (id|msg|ts|file/hash pairs|versions|parent=<id>|)
+std::vector<std::string> makeTokens(size_t c, size_t files) {
+    char id[65], parent[65];
+    snprintf(id, sizeof(id), "%064zx", c * 2654435761u);
+    snprintf(parent, sizeof(parent), "%064zx", c == 0 ? 0 : (c - 1) * 2654435761u);
+    std::vector<std::string> t = {id, "Commit " + std::to_string(c) + " \"tweak\"\tdone", "2026-01-01 12:00:00"};
+    for (size_t f = 0; f < files; ++f) {
+        t.push_back("/var/lib/CodeKeeper/bench/src/module_" + std::to_string(f) + "/file_" + std::to_string(c) + ".cpp");
+        t.push_back(id);
+    }
+    for (size_t f = 0; f < files; ++f) t.push_back("/var/lib/CodeKeeper/bench/versions/version_" + std::to_string(c) + "_" + std::to_string(f));
+    t.push_back(c == 0 ? "parent=" : "parent=" + std::string(parent));
+    return t;
+}
+
+// Same file selection as parseCommit in codekeeper-web.cpp
+std::vector<std::string> listedFiles(const std::vector<std::string>& tokens) {
+    std::vector<std::string> files;
+    size_t n = (tokens.size() - 3) / 3;
+    for (size_t i = 0; i < n; ++i) files.push_back(tokens[3 + 2 * i]);
+    return files;
+}
+
+struct Result {
+    double seconds;
+    uint64_t bytes;
+    uint64_t checksum;
+};
+
+// FNV-1a over everything sent, standing in for the socket
+struct Sink {
+    uint64_t bytes = 0;
+    uint64_t hash = 1469598103934665603ull;
+    bool write(const char* data, size_t n) {
+        for (size_t i = 0; i < n; ++i) hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+        bytes += n;
+        return true;
+    }
+};
+
+Result runTree(size_t commits, size_t files) {
+    std::vector<json> cache;
+    for (size_t c = 0; c < commits; ++c) {
+        auto tokens = makeTokens(c, files);
+        json j;
+        j["id"] = tokens[0];
+        j["message"] = tokens[1];
+        j["timestamp"] = tokens[2];
+        j["files"] = listedFiles(tokens);
+        cache.push_back(std::move(j));
+    }
+    auto start = std::chrono::steady_clock::now();
+    json history = json::array();
+    for (auto it = cache.rbegin(); it != cache.rend(); ++it) history.push_back(*it);
+    json response;
+    response["commits"] = std::move(history);
+    std::string body = response.dump();
+    Sink sink;
+    sink.write(body.data(), body.size());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), sink.bytes, sink.hash};
+}
+
+Result runStream(size_t commits, size_t files) {
+    std::vector<CommitEntry> cache;
+    for (size_t c = 0; c < commits; ++c) {
+        auto tokens = makeTokens(c, files);
+        cache.push_back({tokens[0], tokens[1], tokens[2], listedFiles(tokens)});
+    }
+    auto start = std::chrono::steady_clock::now();
+    Sink sink;
+    JsonWriter w([&sink](const char* data, size_t n) { return sink.write(data, n); });
+    w.beginObject().key("commits").beginArray();
+    for (auto it = cache.rbegin(); it != cache.rend(); ++it) {
+        w.beginObject().key("files").beginArray();
+        for (const auto& f : it->files) w.string(f);
+        w.endArray();
+        w.key("id").string(it->id);
+        w.key("message").string(it->message);
+        w.key("timestamp").string(it->timestamp);
+        w.endObject();
+    }
+    w.endArray().endObject();
+    w.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), sink.bytes, sink.hash};
+}
+
+// Run one mode in a child; report its result through a pipe and its peak RSS through wait4
+bool measure(const char* name, Result (*run)(size_t, size_t), size_t commits, size_t files, Result& out) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result r = run(commits, files);
+        ssize_t n = write(fds[1], &r, sizeof(r));
+        _exit(n == sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], &out, sizeof(out));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || n != sizeof(out) || status != 0) return false;
+    printf("%-7s %8.1f ms  %8.1f MB/s  peak RSS %7.1f MB  (%llu bytes)\n", name, out.seconds * 1000,
+           out.bytes / out.seconds / 1e6, usage.ru_maxrss / 1024.0, (unsigned long long)out.bytes);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    size_t commits = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    size_t files = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    printf("history of %zu commits, %zu files each\n", commits, files);
+    Result tree, stream;
+    if (!measure("tree", runTree, commits, files, tree) || !measure("stream", runStream, commits, files, stream)) {
+        fprintf(stderr, "benchmark child failed\n");
+        return 1;
+    }
+    if (tree.bytes != stream.bytes || tree.checksum != stream.checksum) {
+        fprintf(stderr, "outputs differ\n");
+        return 1;
+    }
+    printf("outputs identical; stream is %.2fx the throughput of tree\n", tree.seconds / stream.seconds);
+    return 0;
+}
@@ -0,0 +1,357 @@
+// Load generator for codekeeper-web.
+//
+// Drives a running server with a weighted mix of login, status, history, add and commit requests,
+// either closed-loop (--concurrency clients, each sending its next request when the last one
+// returns) or open-loop (--rate arrivals per second spread over --concurrency connections).
+// Open-loop latency is measured from each request's scheduled arrival, so a server that falls
+// behind shows up as queueing delay instead of silently lowering the offered load.
+//
+// A commit is POST /api/commit followed by polling /api/jobs/<id> until the job finishes; its
+// latency covers both. add and commit need --workdir, the repository directory the server runs
+// in, where files are rewritten under loadgen/ so every commit has something to store.
+//
+// g++ -std=c++17 -O2 -Iinclude -o build/load-web bench/load-web.cpp -lpthread
+// ./build/load-web [--port 9898] [--mix status=10,history=5,add=2,commit=1,login=1]
+//                  [--concurrency 8 | --rate 200] [--duration 10] [--workdir DIR] [--json]
+
+#include "httplib.h"
+#include "json.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+enum Op { OpLogin, OpStatus, OpHistory, OpAdd, OpCommit, OpCount };
+const char* const kOpNames[OpCount] = {"login", "status", "history", "add", "commit"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 9898;
+    unsigned weights[OpCount] = {1, 10, 5, 2, 1};
+    size_t concurrency = 8;
+    double rate = 0;              // arrivals per second; 0 = closed loop
+    double duration = 10;
+    double warmup = 1;
+    std::string user = "loadgen";
+    std::string password = "loadgen";
+    fs::path workdir;
+    bool json = false;
+    double maxErrorRate = 1.0;
+};
+
+// Latencies and error counts for one client thread; merged once the run is over
+struct Recorder {
+    std::vector<double> latencies[OpCount];   // milliseconds
+    uint64_t errors[OpCount] = {};
+};
+
+class Client {
+public:
+    Client(const Options& opt, size_t index) : opt_(opt), http_(opt.host, opt.port), index_(index) {
+        http_.set_keep_alive(true);
+        http_.set_connection_timeout(5);
+        http_.set_read_timeout(60);
+    }
+
+    // Runs one operation; false on a transport error or an unexpected status
+    bool run(Op op) {
+        switch (op) {
+            case OpLogin: return post("/api/auth/login", json{{"username", opt_.user}, {"password", opt_.password}}, 200);
+            case OpStatus: return get("/api/status");
+            case OpHistory: return get("/api/history");
+            case OpAdd: return post("/api/add", json{{"files", {touch()}}}, 200);
+            case OpCommit: return commit();
+            default: return false;
+        }
+    }
+
+private:
+    bool get(const std::string& path) {
+        auto res = http_.Get(path);
+        return res && res->status == 200;
+    }
+
+    bool post(const std::string& path, const json& body, int expected, json* reply = nullptr) {
+        auto res = http_.Post(path, body.dump(), "application/json");
+        if (!res || res->status != expected) return false;
+        if (reply) *reply = json::parse(res->body, nullptr, false);
+        return true;
+    }
+
+    bool commit() {
+        json reply;
+        std::string file = touch();
+        if (!post("/api/commit", json{{"message", "loadgen " + std::to_string(++sequence_)}, {"files", {file}}}, 202, &reply))
+            return false;
+        std::string job = reply.is_object() ? reply.value("job", "") : "";
+        if (job.empty()) return false;
+        while (true) {
+            auto res = http_.Get("/api/jobs/" + job);
+            if (!res || res->status != 200) return false;
+            json state = json::parse(res->body, nullptr, false);
+            std::string s = state.is_object() ? state.value("state", "") : "";
+            if (s == "done") return true;
+            if (s == "failed" || s.empty()) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    // Rewrites this client's file so the next add or commit sees new content
+    std::string touch() {
+        fs::path p = opt_.workdir / "loadgen" / ("client_" + std::to_string(index_) + ".txt");
+        std::ofstream out(p, std::ios::trunc);
+        out << "client " << index_ << " write " << ++sequence_ << "\n";
+        return p.string();
+    }
+
+    const Options& opt_;
+    httplib::Client http_;
+    size_t index_;
+    uint64_t sequence_ = 0;
+};
+
+class Mix {
+public:
+    explicit Mix(const Options& opt) : dist_(std::begin(opt.weights), std::end(opt.weights)) {}
+    Op pick(std::mt19937_64& rng) { return static_cast<Op>(dist_(rng)); }
+
+private:
+    std::discrete_distribution<int> dist_;
+};
+
+double millisSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Closed loop: every client issues its next request as soon as the previous one completes
+void closedLoop(const Options& opt, Clock::time_point measureFrom, Clock::time_point end,
+                std::vector<Recorder>& recorders) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < opt.concurrency; ++i) {
+        threads.emplace_back([&, i] {
+            Client client(opt, i);
+            Mix mix(opt);
+            std::mt19937_64 rng(i + 1);
+            Recorder& rec = recorders[i];
+            while (Clock::now() < end) {
+                Op op = mix.pick(rng);
+                auto start = Clock::now();
+                bool ok = client.run(op);
+                if (start < measureFrom) continue;
+                rec.latencies[op].push_back(millisSince(start));
+                if (!ok) ++rec.errors[op];
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+}
+
+// Open loop: arrivals on a fixed schedule, queued for whichever connection is free next
+void openLoop(const Options& opt, Clock::time_point measureFrom, Clock::time_point end,
+              std::vector<Recorder>& recorders) {
+    struct Arrival {
+        Op op;
+        Clock::time_point due;
+    };
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Arrival> queue;
+    bool finished = false;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < opt.concurrency; ++i) {
+        threads.emplace_back([&, i] {
+            Client client(opt, i);
+            Recorder& rec = recorders[i];
+            while (true) {
+                Arrival a;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&] { return finished || !queue.empty(); });
+                    if (queue.empty()) return;
+                    a = queue.front();
+                    queue.pop_front();
+                }
+                bool ok = client.run(a.op);
+                if (a.due < measureFrom) continue;
+                rec.latencies[a.op].push_back(millisSince(a.due));
+                if (!ok) ++rec.errors[a.op];
+            }
+        });
+    }
+
+    Mix mix(opt);
+    std::mt19937_64 rng(0);
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / opt.rate));
+    for (auto due = Clock::now(); due < end; due += interval) {
+        std::this_thread::sleep_until(due);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({mix.pick(rng), due});
+        }
+        cv.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+bool parseMix(const std::string& spec, unsigned weights[OpCount]) {
+    std::fill(weights, weights + OpCount, 0);
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? spec.size() : comma + 1;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        auto name = std::find(kOpNames, kOpNames + OpCount, item.substr(0, eq));
+        if (name == kOpNames + OpCount) return false;
+        try { weights[name - kOpNames] = std::stoul(item.substr(eq + 1)); } catch (...) { return false; }
+    }
+    return std::any_of(weights, weights + OpCount, [](unsigned w) { return w > 0; });
+}
+
+void usage() {
+    std::cerr << "Usage: load-web [options]\n"
+                 "  --host <h>            Server host (default: 127.0.0.1)\n"
+                 "  --port <n>            Server port (default: 9898)\n"
+                 "  --mix <op=w,...>      Weights for login, status, history, add, commit\n"
+                 "                        (default: login=1,status=10,history=5,add=2,commit=1)\n"
+                 "  --concurrency <n>     Connections (default: 8)\n"
+                 "  --rate <r>            Open loop: r requests/s over the connections\n"
+                 "  --duration <s>        Measured seconds (default: 10)\n"
+                 "  --warmup <s>          Unmeasured seconds first (default: 1)\n"
+                 "  --user <u> --password <p>   Account to register and log in (default: loadgen)\n"
+                 "  --workdir <dir>       Repository directory of the server; required for add/commit\n"
+                 "  --max-error-rate <f>  Exit 1 when errors/requests exceeds f (default: 1)\n"
+                 "  --json                Print the report as JSON\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--host" && hasValue) opt.host = argv[++i];
+            else if (arg == "--port" && hasValue) opt.port = std::stoi(argv[++i]);
+            else if (arg == "--mix" && hasValue) {
+                if (!parseMix(argv[++i], opt.weights)) { usage(); return 1; }
+            }
+            else if (arg == "--concurrency" && hasValue) opt.concurrency = std::max(1ul, std::stoul(argv[++i]));
+            else if (arg == "--rate" && hasValue) opt.rate = std::stod(argv[++i]);
+            else if (arg == "--duration" && hasValue) opt.duration = std::stod(argv[++i]);
+            else if (arg == "--warmup" && hasValue) opt.warmup = std::stod(argv[++i]);
+            else if (arg == "--user" && hasValue) opt.user = argv[++i];
+            else if (arg == "--password" && hasValue) opt.password = argv[++i];
+            else if (arg == "--workdir" && hasValue) opt.workdir = fs::absolute(argv[++i]);
+            else if (arg == "--max-error-rate" && hasValue) opt.maxErrorRate = std::stod(argv[++i]);
+            else if (arg == "--json") opt.json = true;
+            else { usage(); return arg == "--help" || arg == "-h" ? 0 : 1; }
+        }
+    } catch (const std::exception&) {
+        usage();
+        return 1;
+    }
+
+    if ((opt.weights[OpAdd] || opt.weights[OpCommit]) && opt.workdir.empty()) {
+        std::cerr << "Error: add and commit need --workdir (or a --mix without them).\n";
+        return 1;
+    }
+    if (!opt.workdir.empty()) fs::create_directories(opt.workdir / "loadgen");
+
+    // Account setup: registering twice fails harmlessly, logging in must work
+    httplib::Client setup(opt.host, opt.port);
+    json creds = {{"username", opt.user}, {"password", opt.password}};
+    setup.Post("/api/auth/register", creds.dump(), "application/json");
+    auto login = setup.Post("/api/auth/login", creds.dump(), "application/json");
+    if (!login || login->status != 200) {
+        std::cerr << "Error: could not log in to " << opt.host << ":" << opt.port << "\n";
+        return 1;
+    }
+
+    std::vector<Recorder> recorders(opt.concurrency);
+    auto start = Clock::now();
+    auto measureFrom = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.warmup));
+    auto end = measureFrom + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.duration));
+    if (opt.rate > 0) openLoop(opt, measureFrom, end, recorders);
+    else closedLoop(opt, measureFrom, end, recorders);
+    double elapsed = std::chrono::duration<double>(Clock::now() - measureFrom).count();
+
+    json report = {{"mode", opt.rate > 0 ? "open" : "closed"}, {"concurrency", opt.concurrency},
+                   {"seconds", elapsed}, {"ops", json::object()}};
+    if (opt.rate > 0) report["rate"] = opt.rate;
+    uint64_t total = 0, errors = 0;
+    std::vector<double> all;
+    for (size_t op = 0; op < OpCount; ++op) {
+        std::vector<double> lat;
+        uint64_t err = 0;
+        for (auto& rec : recorders) {
+            lat.insert(lat.end(), rec.latencies[op].begin(), rec.latencies[op].end());
+            err += rec.errors[op];
+        }
+        if (lat.empty()) continue;
+        std::sort(lat.begin(), lat.end());
+        all.insert(all.end(), lat.begin(), lat.end());
+        total += lat.size();
+        errors += err;
+        report["ops"][kOpNames[op]] = {{"count", lat.size()}, {"errors", err},
+                                       {"throughput", lat.size() / elapsed},
+                                       {"p50_ms", percentile(lat, 50)}, {"p90_ms", percentile(lat, 90)},
+                                       {"p99_ms", percentile(lat, 99)}, {"p999_ms", percentile(lat, 99.9)},
+                                       {"max_ms", lat.back()}};
+    }
+    std::sort(all.begin(), all.end());
+    report["requests"] = total;
+    report["errors"] = errors;
+    report["throughput"] = total / elapsed;
+    report["p50_ms"] = percentile(all, 50);
+    report["p99_ms"] = percentile(all, 99);
+
+    if (opt.json) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        printf("%s loop, %zu connections%s, %.1fs measured\n", opt.rate > 0 ? "Open" : "Closed", opt.concurrency,
+               opt.rate > 0 ? (", " + std::to_string(static_cast<int>(opt.rate)) + " req/s offered").c_str() : "",
+               elapsed);
+        printf("%-8s %9s %7s %9s %9s %9s %9s %9s %9s\n", "op", "count", "errors", "req/s", "p50 ms", "p90 ms",
+               "p99 ms", "p99.9 ms", "max ms");
+        for (auto& [name, o] : report["ops"].items()) {
+            printf("%-8s %9llu %7llu %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f\n", name.c_str(),
+                   o["count"].get<unsigned long long>(), o["errors"].get<unsigned long long>(),
+                   o["throughput"].get<double>(), o["p50_ms"].get<double>(), o["p90_ms"].get<double>(),
+                   o["p99_ms"].get<double>(), o["p999_ms"].get<double>(), o["max_ms"].get<double>());
+        }
+        printf("%-8s %9llu %7llu %9.1f %9.2f %9s %9.2f\n", "total", static_cast<unsigned long long>(total),
+               static_cast<unsigned long long>(errors), total / elapsed, percentile(all, 50), "",
+               percentile(all, 99));
+    }
+
+    return total > 0 && static_cast<double>(errors) / total > opt.maxErrorRate ? 1 : 0;
+}
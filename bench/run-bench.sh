@@ -0,0 +1,154 @@
+#!/bin/bash
+
+# CodeKeeper benchmark suite.
+#
+# For each scale (file count) it generates a synthetic repository with bench/gen-repo, then times
+# the CLI (init, add, commit, status, history, rollback, list-conflicts, push, pull) and the main
+# web endpoints against it. Every measurement is one JSON line on stdout (or --out), tagged with
+# the source version, so results from two builds can be put side by side with bench/compare.sh.
+#
+#   bench/run-bench.sh [--scales 1000,100000,1000000] [--commits 20] [--churn 0.01]
+#                      [--size-dist lognormal:2048] [--repeat 3] [--port 9897]
+#                      [--bin build] [--work /tmp/codekeeper-bench] [--out results.jsonl]
+#
+# Expects build/codekeeper, build/codekeeper-web and build/gen-repo (see README, Benchmarks);
+# build/bench-hash, if built, adds hashing throughput lines.
+# The 1M scale writes the tree, the staging copies and the stored versions: plan on ~3x the
+# generated size in free disk space under --work.
+
+set -e
+
+SCALES="1000,100000,1000000"
+COMMITS=20
+CHURN=0.01
+SIZE_DIST="lognormal:2048"
+REPEAT=3
+PORT=9897
+BIN="$(pwd)/build"
+WORK="/tmp/codekeeper-bench"
+OUT=""
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --scales) SCALES="$2"; shift 2 ;;
+        --commits) COMMITS="$2"; shift 2 ;;
+        --churn) CHURN="$2"; shift 2 ;;
+        --size-dist) SIZE_DIST="$2"; shift 2 ;;
+        --repeat) REPEAT="$2"; shift 2 ;;
+        --port) PORT="$2"; shift 2 ;;
+        --bin) BIN="$(cd "$2" && pwd)"; shift 2 ;;
+        --work) WORK="$2"; shift 2 ;;
+        --out) OUT="$2"; shift 2 ;;
+        -h|--help) sed -n '3,16p' "$0" | sed 's/^# \{0,1\}//'; exit 0 ;;
+        *) echo "Unknown option: $1" >&2; exit 1 ;;
+    esac
+done
+
+for tool in codekeeper codekeeper-web gen-repo; do
+    if [ ! -x "$BIN/$tool" ]; then
+        echo "Missing $BIN/$tool; build it first (README, Benchmarks)." >&2
+        exit 1
+    fi
+done
+
+if [ -n "$OUT" ]; then
+    exec > "$OUT"
+fi
+
+VERSION="$(git -C "$(dirname "$0")" describe --always --dirty 2>/dev/null || echo unknown)"
+CK="$BIN/codekeeper"
+WEB_PID=""
+
+cleanup() {
+    if [ -n "$WEB_PID" ]; then kill "$WEB_PID" 2>/dev/null || true; fi
+}
+trap cleanup EXIT
+
+now_ns() { date +%s%N; }
+
+# emit <scale> <op> <ok> <seconds...>: one result line with every sample and their median
+emit() {
+    local scale="$1" op="$2" ok="$3"
+    shift 3
+    local samples median
+    samples="$(IFS=,; echo "$*")"
+    median="$(printf '%s\n' "$@" | sort -g | awk '{ v[NR] = $1 } END { print (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }')"
+    printf '{"version":"%s","scale":%s,"op":"%s","ok":%s,"median_s":%s,"samples":[%s],"commits":%s,"churn":%s,"size_dist":"%s"}\n' \
+        "$VERSION" "$scale" "$op" "$ok" "$median" "$samples" "$COMMITS" "$CHURN" "$SIZE_DIST"
+}
+
+# measure <scale> <op> <runs> <command...>: time the command `runs` times; output is discarded
+measure() {
+    local scale="$1" op="$2" runs="$3"
+    shift 3
+    local samples=() ok=true start end
+    for ((r = 0; r < runs; r++)); do
+        start="$(now_ns)"
+        if ! "$@" > /dev/null 2>&1; then
+            echo "warning: $op failed at scale $scale" >&2
+            ok=false
+        fi
+        end="$(now_ns)"
+        samples+=("$(awk -v ns="$((end - start))" 'BEGIN { printf "%.6f", ns / 1e9 }')")
+    done
+    emit "$scale" "$op" "$ok" "${samples[@]}"
+}
+
+get() { curl -sf -o /dev/null "http://127.0.0.1:$PORT$1"; }
+
+# Hashing throughput (GB/s), when build/bench-hash is there
+if [ -x "$BIN/bench-hash" ]; then
+    "$BIN/bench-hash" --json | sed "s/^{/{\"version\":\"$VERSION\",/"
+fi
+
+IFS=',' read -ra SCALE_LIST <<< "$SCALES"
+for scale in "${SCALE_LIST[@]}"; do
+    dir="$WORK/repo-$scale"
+    remote="$WORK/remote-$scale"
+    rm -rf "$dir" "$remote"
+    mkdir -p "$dir" "$remote/versions"
+    cd "$dir"
+
+    measure "$scale" generate 1 "$BIN/gen-repo" "$dir" --files "$scale" --size-dist "$SIZE_DIST"
+    measure "$scale" init 1 "$CK" init bench --local
+    "$CK" auth register bench bench > /dev/null
+    "$CK" auth login bench bench > /dev/null
+
+    measure "$scale" add 1 "$CK" add .
+    measure "$scale" commit 1 "$CK" commit "Initial import"
+    measure "$scale" status "$REPEAT" "$CK" status
+
+    # History with churn on top of the import, through the engine rather than one CLI call each
+    measure "$scale" churn-commits 1 "$BIN/gen-repo" "$dir" --files "$scale" --size-dist "$SIZE_DIST" \
+        --commits "$((COMMITS + 1))" --churn "$CHURN"
+    measure "$scale" history "$REPEAT" "$CK" history
+    measure "$scale" list-conflicts "$REPEAT" "$CK" list-conflicts
+    target="$(find "$dir" -name 'file_00000000.txt' | head -n 1)"
+    measure "$scale" rollback "$REPEAT" "$CK" rollback "$target"
+
+    "$CK" set-remote "$remote" > /dev/null
+    measure "$scale" push 1 "$CK" push
+    measure "$scale" pull 1 "$CK" pull
+
+    "$BIN/codekeeper-web" "$PORT" --dir "$dir" > /dev/null 2>&1 &
+    WEB_PID=$!
+    up=false
+    for _ in $(seq 1 100); do
+        if get /api/status; then up=true; break; fi
+        sleep 0.1
+    done
+    if [ "$up" = true ]; then
+        for endpoint in /api/status /api/history /api/summary /api/branches /api/list-conflicts; do
+            get "$endpoint" || true   # warm the server's caches once
+            measure "$scale" "GET $endpoint" "$REPEAT" get "$endpoint"
+        done
+    else
+        echo "warning: codekeeper-web did not answer on port $PORT; skipping web endpoints at scale $scale" >&2
+    fi
+    kill "$WEB_PID" 2>/dev/null || true
+    wait "$WEB_PID" 2>/dev/null || true
+    WEB_PID=""
+
+    cd - > /dev/null
+    rm -rf "$dir" "$remote"
+done
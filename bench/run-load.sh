@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Self-contained load run against localhost, suitable for CI: creates a scratch repository,
+# starts codekeeper-web on it, runs bench/load-web, then stops the server and cleans up.
+# Arguments are passed through to load-web (e.g. --rate 200 --duration 30 --json).
+#
+#   bench/run-load.sh [--bin build] [--port 9896] [load-web options...]
+#
+# Exits with load-web's status, so --max-error-rate can fail a CI job.
+
+set -e
+
+BIN="$(pwd)/build"
+PORT=9896
+ARGS=()
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --bin) BIN="$(cd "$2" && pwd)"; shift 2 ;;
+        --port) PORT="$2"; shift 2 ;;
+        *) ARGS+=("$1"); shift ;;
+    esac
+done
+
+for tool in codekeeper codekeeper-web load-web; do
+    if [ ! -x "$BIN/$tool" ]; then
+        echo "Missing $BIN/$tool; build it first (README, Benchmarks)." >&2
+        exit 1
+    fi
+done
+
+WORK="$(mktemp -d /tmp/codekeeper-load.XXXXXX)"
+WEB_PID=""
+cleanup() {
+    if [ -n "$WEB_PID" ]; then kill "$WEB_PID" 2>/dev/null || true; fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+cd "$WORK"
+"$BIN/codekeeper" init load --local > /dev/null
+
+"$BIN/codekeeper-web" "$PORT" --dir "$WORK" > "$WORK/.server.log" 2>&1 &
+WEB_PID=$!
+for _ in $(seq 1 100); do
+    curl -sf -o /dev/null "http://127.0.0.1:$PORT/api/status" && break
+    sleep 0.1
+done
+
+status=0
+"$BIN/load-web" --port "$PORT" --workdir "$WORK" "${ARGS[@]}" || status=$?
+exit $status
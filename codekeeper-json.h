@@ -0,0 +1,159 @@
+#pragma once
+
+// Streaming JSON writer for large API responses (history, status, conflicts).
+//
+// Values go straight into a fixed buffer that is handed to a sink whenever it fills, so a
+// response of any size is written without building a json tree or a complete string first.
+// Output is byte-identical to nlohmann::json::dump() for the same document, provided the caller
+// writes object keys in sorted order (dump() sorts them) and strings are valid UTF-8.
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+class JsonWriter {
+public:
+    using Sink = std::function<bool(const char*, size_t)>;
+
+    explicit JsonWriter(Sink sink = nullptr) : sink_(std::move(sink)) {}
+
+    // Switch sinks between provider calls; buffered output goes to whichever sink flushes it
+    void setSink(Sink sink) { sink_ = std::move(sink); }
+
+    JsonWriter& beginObject() { return open('{'); }
+    JsonWriter& endObject() { return close('}'); }
+    JsonWriter& beginArray() { return open('['); }
+    JsonWriter& endArray() { return close(']'); }
+
+    JsonWriter& key(std::string_view k) {
+        separator();
+        quoted(k);
+        put(':');
+        afterKey_ = true;
+        return *this;
+    }
+
+    JsonWriter& string(std::string_view s) {
+        separator();
+        quoted(s);
+        return *this;
+    }
+
+    JsonWriter& number(uint64_t n) {
+        separator();
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), n).ptr;
+        write(digits, end - digits);
+        return *this;
+    }
+
+    JsonWriter& null() {
+        separator();
+        write("null", 4);
+        return *this;
+    }
+
+    JsonWriter& boolean(bool b) {
+        separator();
+        if (b) write("true", 4);
+        else write("false", 5);
+        return *this;
+    }
+
+    // Hand buffered output to the sink; false once the sink has refused data
+    bool flush() {
+        if (len_ > 0 && ok_) ok_ = sink_ && sink_(buffer_, len_);
+        len_ = 0;
+        return ok_;
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    static constexpr size_t kMaxDepth = 64;
+
+    JsonWriter& open(char c) {
+        separator();
+        put(c);
+        if (depth_ < kMaxDepth) first_[depth_] = true;
+        ++depth_;
+        return *this;
+    }
+
+    JsonWriter& close(char c) {
+        if (depth_ > 0) --depth_;
+        put(c);
+        return *this;
+    }
+
+    // Comma before every element but the first of its container; nothing after a key
+    void separator() {
+        if (afterKey_) {
+            afterKey_ = false;
+            return;
+        }
+        if (depth_ == 0 || depth_ > kMaxDepth) return;
+        if (first_[depth_ - 1]) first_[depth_ - 1] = false;
+        else put(',');
+    }
+
+    // Same escapes as nlohmann's dump(): short forms where JSON has them, \u00xx for other
+    // control characters, everything else (including UTF-8) copied through
+    void quoted(std::string_view s) {
+        put('"');
+        size_t run = 0;
+        for (size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            const char* esc = nullptr;
+            switch (c) {
+                case '"': esc = "\\\""; break;
+                case '\\': esc = "\\\\"; break;
+                case '\b': esc = "\\b"; break;
+                case '\f': esc = "\\f"; break;
+                case '\n': esc = "\\n"; break;
+                case '\r': esc = "\\r"; break;
+                case '\t': esc = "\\t"; break;
+                default: break;
+            }
+            if (!esc && c >= 0x20) continue;
+            write(s.data() + run, i - run);
+            run = i + 1;
+            if (esc) {
+                write(esc, 2);
+            } else {
+                static const char hex[] = "0123456789abcdef";
+                char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                write(u, sizeof(u));
+            }
+        }
+        write(s.data() + run, s.size() - run);
+        put('"');
+    }
+
+    void put(char c) {
+        if (len_ == sizeof(buffer_)) flush();
+        buffer_[len_++] = c;
+    }
+
+    void write(const char* data, size_t n) {
+        while (n > 0) {
+            if (len_ == sizeof(buffer_)) flush();
+            size_t chunk = std::min(n, sizeof(buffer_) - len_);
+            std::memcpy(buffer_ + len_, data, chunk);
+            len_ += chunk;
+            data += chunk;
+            n -= chunk;
+        }
+    }
+
+    Sink sink_;
+    char buffer_[16 * 1024];
+    size_t len_ = 0;
+    bool first_[kMaxDepth] = {};
+    size_t depth_ = 0;
+    bool afterKey_ = false;
+    bool ok_ = true;
+};
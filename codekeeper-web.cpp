@@ -1,5 +1,7 @@
 #include "httplib.h"
 #include "json.hpp"
+#include "codekeeper-json.h"
+#include "libcodekeeper.h"
 
 #include <iostream>
 #include <fstream>
@@ -19,88 +21,47 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <fcntl.h>
+#include <csignal>
+
+// Everything lives in codekeeper_web so the CLI can link this file and serve in-process
+// (built with -DCODEKEEPER_WITH_WEB); on its own it is the codekeeper-web binary.
+namespace codekeeper_web {
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
+using codekeeper::split;
+using codekeeper::CommitProgress;
+using codekeeper::PhaseCount;
 
 // ====== CodeKeeper Core (adapted from codekeeper.cpp) ======
 
-std::string repositoryPath;
-std::string currentUser;
-bool isAuthenticated = false;
-
-std::string getTimestamp() {
-    std::time_t now = std::time(nullptr);
-    char buf[80];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    return buf;
-}
-
-std::vector<std::string> split(const std::string &str, char delimiter) {
-    std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (std::getline(ss, token, delimiter)) tokens.push_back(token);
-    return tokens;
-}
-
-bool filesAreEqual(const std::string &fp1, const std::string &fp2) {
-    std::ifstream f1(fp1, std::ios::binary);
-    std::ifstream f2(fp2, std::ios::binary);
-    return std::equal(std::istreambuf_iterator<char>(f1), std::istreambuf_iterator<char>(),
-                      std::istreambuf_iterator<char>(f2));
-}
+// Per-thread so concurrent requests for different repositories don't clobber each other
+thread_local std::string repositoryPath;
+thread_local std::string currentUser;
+thread_local bool isAuthenticated = false;
 
-std::string escape(const std::string& input) {
-    std::string output;
-    for (char c : input) {
-        if (c == '|') output += "\\|";
-        else output += c;
-    }
-    return output;
-}
-
-std::string computeStringHash(const std::string& input) {
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) return "";
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int length = 0;
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1 ||
-        EVP_DigestUpdate(ctx, input.c_str(), input.size()) != 1 ||
-        EVP_DigestFinal_ex(ctx, hash, &length) != 1) {
-        EVP_MD_CTX_free(ctx);
-        return "";
-    }
-    EVP_MD_CTX_free(ctx);
-    std::ostringstream result;
-    for (unsigned int i = 0; i < length; ++i)
-        result << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    return result.str();
-}
-
-std::string computeFileHash(const fs::path& filePath) {
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file) return "";
-    EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-    if (!mdctx) return "";
-    const EVP_MD* md = EVP_sha256();
-    if (1 != EVP_DigestInit_ex(mdctx, md, nullptr)) { EVP_MD_CTX_free(mdctx); return ""; }
-    char buffer[8192];
-    while (file.good()) {
-        file.read(buffer, sizeof(buffer));
-        if (1 != EVP_DigestUpdate(mdctx, buffer, file.gcount())) { EVP_MD_CTX_free(mdctx); return ""; }
-    }
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen = 0;
-    if (1 != EVP_DigestFinal_ex(mdctx, hash, &hashLen)) { EVP_MD_CTX_free(mdctx); return ""; }
-    EVP_MD_CTX_free(mdctx);
-    std::ostringstream result;
-    for (unsigned int i = 0; i < hashLen; ++i)
-        result << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    return result.str();
-}
+// Repository bound to the current request when serving several repositories; when set,
+// loadRepositoryPath() uses it instead of reading .repo_path
+thread_local std::string scopedRepositoryPath;
 
 void loadRepositoryPath() {
+    if (!scopedRepositoryPath.empty()) {
+        repositoryPath = scopedRepositoryPath;
+        return;
+    }
     std::ifstream repoFile(".repo_path");
     if (repoFile.is_open()) {
         std::getline(repoFile, repositoryPath);
@@ -110,19 +71,8 @@ void loadRepositoryPath() {
     }
 }
 
-bool isPathSafe(const std::string& filePath) {
-    try {
-        fs::path resolved = fs::weakly_canonical(fs::absolute(filePath));
-        fs::path repo = fs::weakly_canonical(fs::absolute(repositoryPath));
-        auto rel = fs::relative(resolved, repo);
-        return !rel.empty() && rel.string().find("..") == std::string::npos;
-    } catch (...) {
-        return false;
-    }
-}
-
 std::string hashPassword(const std::string& username, const std::string& password) {
-    return computeStringHash(username + ":" + password);
+    return codekeeper::hashString(username + ":" + password);
 }
 
 bool registerUser(const std::string& username, const std::string& password) {
@@ -156,7 +106,11 @@ bool authenticateUser(const std::string& username, const std::string& password)
     return false;
 }
 
+// Set while a batch runs: the session it loaded up front stays in effect for every operation
+thread_local bool sessionPinned = false;
+
 void loadSession() {
+    if (sessionPinned) return;
     loadRepositoryPath();
     if (repositoryPath.empty()) return;
     std::ifstream sessionFile(fs::path(repositoryPath) / ".session");
@@ -192,23 +146,6 @@ void logoutUser() {
     clearSession();
 }
 
-bool runHook(const std::string& hookName) {
-    fs::path hookPath = fs::path(repositoryPath) / hookName;
-    if (fs::exists(hookPath) && fs::is_regular_file(hookPath)) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            execlp("/bin/bash", "bash", hookPath.c_str(), nullptr);
-            _exit(127);
-        } else if (pid > 0) {
-            int status;
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) return true;
-            return false;
-        }
-    }
-    return true;
-}
-
 void initRepository(const std::string& projectName, bool local = false) {
     std::regex safeName("^[a-zA-Z0-9_-]+$");
     if (!std::regex_match(projectName, safeName))
@@ -237,271 +174,859 @@ void initRepository(const std::string& projectName, bool local = false) {
     chmod((repoPath / ".users").c_str(), 0600);
 }
 
-// Recursively collect regular files from a path (skips hidden, repo, and binary files)
-std::vector<std::string> collectFiles(const std::string& path) {
+// Engine for the current request's repository; null when uninitialized
+std::shared_ptr<codekeeper::Repository> openRepository() {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) return nullptr;
+    return codekeeper::Repository::open(repositoryPath);
+}
+
+void addToStaging(const std::vector<std::string>& filePaths) {
+    if (auto repo = openRepository()) repo->stage(filePaths);
+}
+
+void resetStaging(const std::vector<std::string>& filePaths) {
+    if (auto repo = openRepository()) repo->unstage(filePaths);
+}
+
+std::vector<std::string> getStagedFiles() {
+    auto repo = openRepository();
+    return repo ? repo->stagedFiles() : std::vector<std::string>();
+}
+
+// Commit files (or the staging area); returns the new commit ID, throws on failure
+std::string commitFiles(const std::vector<std::string>& filePaths, const std::string& commitMessage,
+                        CommitProgress* progress = nullptr) {
+    auto repo = openRepository();
+    if (!repo) throw std::runtime_error("Repository not initialized");
+    return repo->commit(filePaths, commitMessage, progress).id;
+}
+
+// Throws when the target is outside the repository or was never committed
+void rollback(const std::string &target, const std::string &commitGUID = "") {
+    auto repo = openRepository();
+    if (!repo) throw std::runtime_error("Repository not initialized");
+    repo->rollback(target, commitGUID);
+}
+
+void createBranch(const std::string &branchName) {
+    if (auto repo = openRepository()) repo->createBranch(branchName);
+}
+
+// Throws when the branch does not exist or would overwrite uncommitted changes
+codekeeper::Repository::Checkout switchBranch(const std::string& branchName) {
+    auto repo = openRepository();
+    if (!repo) throw std::runtime_error("Repository not initialized");
+    return repo->switchBranch(branchName);
+}
+
+// One commit as listed by the history API
+struct CommitEntry {
+    std::string id;
+    std::string message;
+    std::string timestamp;
     std::vector<std::string> files;
-    fs::path p = fs::absolute(path);
-    if (!fs::exists(p)) return files;
-    if (fs::is_regular_file(p)) {
-        files.push_back(p.string());
-    } else if (fs::is_directory(p)) {
-        for (const auto& entry : fs::recursive_directory_iterator(p)) {
-            if (fs::is_regular_file(entry)) {
-                std::string fname = entry.path().filename().string();
-                if (fname[0] == '.' || fname == "commit_log.txt" || fname == "codekeeper" || fname == "codekeeper.exe") continue;
-                auto rel = fs::relative(entry.path(), p);
-                bool inInternal = false;
-                for (const auto& part : rel) {
-                    std::string s = part.string();
-                    if (s == ".staging" || s == "versions" || s == "branches" || s[0] == '.') { inInternal = true; break; }
-                }
-                if (!inInternal) files.push_back(fs::absolute(entry.path()).string());
+};
+
+CommitEntry parseCommit(const std::vector<std::string>& tokens) {
+    CommitEntry commit{tokens[0], tokens[1], tokens[2], {}};
+    // id|message|timestamp|file1|hash1|...|fileN|hashN|version1|...|versionN|[parent=<id>|]
+    size_t n = (tokens.size() - 3) / 3;
+    for (size_t i = 0; i < n; ++i) commit.files.push_back(tokens[3 + 2 * i]);
+    return commit;
+}
+
+json commitToJson(const CommitEntry& commit) {
+    json j;
+    j["id"] = commit.id;
+    j["message"] = commit.message;
+    j["timestamp"] = commit.timestamp;
+    j["files"] = commit.files;
+    return j;
+}
+
+json commitToJson(const std::vector<std::string>& tokens) {
+    return commitToJson(parseCommit(tokens));
+}
+
+// Same bytes as commitToJson(commit).dump(): keys in dump()'s sorted order
+void writeCommit(JsonWriter& w, const CommitEntry& commit) {
+    w.beginObject().key("files").beginArray();
+    for (const auto& f : commit.files) w.string(f);
+    w.endArray();
+    w.key("id").string(commit.id);
+    w.key("message").string(commit.message);
+    w.key("timestamp").string(commit.timestamp);
+    w.endObject();
+}
+
+std::vector<std::string> getBranches() {
+    auto repo = openRepository();
+    return repo ? repo->branches() : std::vector<std::string>();
+}
+
+std::string getCurrentBranch() {
+    auto repo = openRepository();
+    return repo ? repo->currentBranch() : "main";
+}
+
+std::vector<std::string> listConflicts() {
+    auto repo = openRepository();
+    return repo ? repo->conflicts() : std::vector<std::string>();
+}
+
+// ====== Live events (/api/events) ======
+
+struct RepoEvent {
+    uint64_t seq;
+    std::string type;
+    std::string data;
+};
+
+// Bounded ring of recent events; SSE subscribers block on it until something newer arrives
+class EventBus {
+public:
+    void publish(const std::string& type, const json& data) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ring_.push_back({nextSeq_++, type, data.dump()});
+            bytes_ += ring_.back().data.size();
+            if (ring_.size() > kCapacity) {
+                bytes_ -= ring_.front().data.size();
+                ring_.pop_front();
             }
         }
+        cv_.notify_all();
     }
-    return files;
-}
 
-void addToStaging(const std::vector<std::string>& filePaths) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return;
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    if (!fs::exists(stagingDir)) fs::create_directory(stagingDir);
-    for (const auto& filePath : filePaths) {
-        auto expanded = collectFiles(filePath);
-        for (const auto& src : expanded) {
-            if (!isPathSafe(src)) continue;
-            fs::path dest = stagingDir / fs::path(src).filename();
-            fs::copy(src, dest, fs::copy_options::overwrite_existing);
+    uint64_t latestSeq() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return nextSeq_ - 1;
+    }
+
+    size_t bytes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+
+    // Events newer than `since`. Sets `lost` when the subscriber fell behind the ring, or holds an
+    // ID this bus never issued (an EventSource reconnecting after a server restart); the latter
+    // starts it over from 0, so `since` is reset.
+    std::vector<RepoEvent> waitFor(uint64_t& since, std::chrono::milliseconds timeout, bool& lost) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        bool restarted = since >= nextSeq_;
+        if (restarted) since = 0;
+        else cv_.wait_for(lock, timeout, [&] { return nextSeq_ - 1 > since; });
+        std::vector<RepoEvent> events;
+        lost = restarted || (!ring_.empty() && ring_.front().seq > since + 1);
+        for (const auto& e : ring_)
+            if (e.seq > since) events.push_back(e);
+        return events;
+    }
+
+private:
+    static constexpr size_t kCapacity = 256;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<RepoEvent> ring_;
+    size_t bytes_ = 0;
+    uint64_t nextSeq_ = 1;
+};
+
+// Last state published to subscribers, so the server's own write paths and the inotify
+// watcher can both call syncEvents() without producing duplicate deltas.
+struct PublishedState {
+    bool primed = false;
+    std::uintmax_t logOffset = 0;
+    uint64_t generation = 0;   // engine history generation the offset belongs to
+    std::vector<std::string> staged;
+    std::vector<std::string> branches;
+    std::string current;
+};
+
+// ====== Repository handles (/r/<name>/api/...) ======
+
+// Everything the server keeps warm for one repository: the parsed commit log, the event
+// stream and its published snapshot. Handles are cached in RepoRegistry.
+class RepoHandle {
+public:
+    RepoHandle(std::string name, std::string path)
+        : name(std::move(name)), path(std::move(path)), engine(codekeeper::Repository::open(this->path)) {}
+
+    const std::string name;   // empty for the repository named in .repo_path
+    const std::string path;
+    // Shared with every request for this repository, so its hash and log caches stay warm
+    const std::shared_ptr<codekeeper::Repository> engine;
+    EventBus events;
+    std::mutex writeMutex;    // held by commit jobs, batches and mutating routes while they change the repository
+
+    // Diff the repository against the last published state and emit commit/staging/branch events
+    void syncEvents() {
+        std::lock_guard<std::mutex> lock(publishMutex_);
+        fs::path logPath = fs::path(path) / "commit_log.txt";
+        std::error_code ec;
+        std::uintmax_t logSize = fs::file_size(logPath, ec);
+        if (ec) logSize = 0;
+        uint64_t generation = engine->historyGeneration();
+        if (logSize < published_.logOffset || (published_.primed && generation != published_.generation)) {
+            // Log was replaced (e.g. pull); clients must refetch everything
+            published_.logOffset = logSize;
+            events.publish("resync", json::object());
+        } else if (!published_.primed) {
+            // Existing history is not a delta
+            published_.logOffset = logSize;
+        } else if (logSize > published_.logOffset) {
+            std::ifstream logFile(logPath);
+            logFile.seekg(static_cast<std::streamoff>(published_.logOffset));
+            std::string line;
+            // Only consume complete lines; a partially appended one is picked up next time
+            while (std::getline(logFile, line) && !logFile.eof()) {
+                published_.logOffset += line.size() + 1;
+                std::vector<std::string> tokens = split(line, '|');
+                if (tokens.size() < 5) continue;
+                events.publish("commit", commitToJson(tokens));
+            }
+        }
+
+        std::vector<std::string> staged = engine->stagedFiles();
+        std::sort(staged.begin(), staged.end());
+        if (staged != published_.staged) {
+            published_.staged = staged;
+            if (published_.primed) events.publish("staging", {{"staged", staged}});
+        }
+
+        std::vector<std::string> branches = engine->branches();
+        std::string current = engine->currentBranch();
+        if (branches != published_.branches || current != published_.current) {
+            published_.branches = branches;
+            published_.current = current;
+            if (published_.primed) events.publish("branches", {{"branches", branches}, {"current", current}});
         }
+        published_.generation = generation;
+        published_.primed = true;
     }
-}
 
-void resetStaging(const std::vector<std::string>& filePaths) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return;
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    for (const auto& filePath : filePaths) {
-        fs::path stagedFile = stagingDir / fs::path(filePath).filename();
-        if (fs::exists(stagedFile)) fs::remove(stagedFile);
+    // Commit history, newest first, served from the cached log index
+    json history() {
+        std::lock_guard<std::mutex> lock(logMutex_);
+        refreshLog();
+        json result = json::array();
+        for (auto it = commits_.rbegin(); it != commits_.rend(); ++it) result.push_back(commitToJson(*it));
+        return result;
     }
-}
 
-std::vector<std::string> getStagedFiles() {
-    loadRepositoryPath();
-    std::vector<std::string> stagedFiles;
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    if (fs::exists(stagingDir)) {
-        for (const auto& entry : fs::directory_iterator(stagingDir)) {
-            if (fs::is_regular_file(entry)) stagedFiles.push_back(entry.path().filename().string());
+    // Number of commits a history stream will cover, and the log generation it is reading
+    size_t historySize(uint64_t& generation) {
+        std::lock_guard<std::mutex> lock(logMutex_);
+        refreshLog();
+        generation = logGeneration_;
+        return commits_.size();
+    }
+
+    // Write up to `max` commits of the first `total`, newest first, skipping the `skip` newest.
+    // Returns false when the log has been replaced since the stream began.
+    bool writeHistory(JsonWriter& w, size_t total, size_t skip, size_t max, uint64_t generation) {
+        std::lock_guard<std::mutex> lock(logMutex_);
+        if (generation != logGeneration_) return false;
+        for (size_t i = skip; i < total && i < skip + max; ++i) writeCommit(w, commits_[total - 1 - i]);
+        return true;
+    }
+
+    // Summary stats, computed on first request from the cached log index
+    json summary() {
+        json j;
+        j["name"] = name;
+        {
+            std::lock_guard<std::mutex> lock(logMutex_);
+            refreshLog();
+            j["commits"] = commits_.size();
+            j["lastCommit"] = commits_.empty() ? json(nullptr) : json(commits_.back().timestamp);
         }
+        std::lock_guard<std::mutex> lock(publishMutex_);
+        j["staged"] = published_.staged.size();
+        j["branches"] = published_.branches.size();
+        j["branch"] = published_.current;
+        return j;
     }
-    return stagedFiles;
-}
 
-void commitFiles(const std::vector<std::string>& filePaths, const std::string& commitMessage) {
-    loadRepositoryPath();
-    fs::path repoPath = fs::weakly_canonical(repositoryPath);
-    fs::path versionDir = repoPath / "versions";
-    if (repositoryPath.empty() || !fs::exists(versionDir)) return;
-    if (!runHook(".pre-commit")) return;
-    std::vector<std::string> filesToCommit = filePaths;
-    fs::path stagingDir = repoPath / ".staging";
-    if (fs::exists(stagingDir)) {
-        std::vector<std::string> staged = getStagedFiles();
-        if (!staged.empty() && filesToCommit.empty()) {
-            filesToCommit.clear();
-            for (auto& s : staged) filesToCommit.push_back(fs::absolute(repoPath / ".staging" / s).string());
-        }
-    }
-    std::ifstream bypassFile(repoPath / ".bypass");
-    std::vector<std::string> ignoredFiles;
-    std::string line;
-    while (std::getline(bypassFile, line)) {
-        if (!line.empty() && line[0] != '#') ignoredFiles.push_back(line);
-    }
-    std::vector<std::string> versionPaths;
-    std::vector<std::string> fileHashes;
-    // Expand directories to individual files
-    std::vector<std::string> expandedFiles;
-    for (const auto& fp : filesToCommit) {
-        auto collected = collectFiles(fp);
-        expandedFiles.insert(expandedFiles.end(), collected.begin(), collected.end());
-    }
-    for (const auto& filePath : expandedFiles) {
-        if (!isPathSafe(filePath)) continue;
-        fs::path file = fs::absolute(filePath);
-        if (!fs::exists(file)) continue;
-        if (std::find(ignoredFiles.begin(), ignoredFiles.end(), filePath) != ignoredFiles.end()) continue;
-        std::string versionFile = "version_" + std::to_string(std::time(nullptr)) + "_" + file.filename().string();
-        fs::path versionFilePath = versionDir / versionFile;
-        fs::copy(file, versionFilePath, fs::copy_options::overwrite_existing);
-        versionPaths.push_back(versionFilePath.string());
-        fileHashes.push_back(computeFileHash(file));
-    }
-    std::string timestamp = getTimestamp();
-
-    // Use expanded file list for commit, not original paths
-    filesToCommit = expandedFiles;
-    if (filesToCommit.empty()) return;
-
-    std::string parentHash;
-    {
-        std::ifstream lf(repoPath / "commit_log.txt");
-        std::string lastLine;
-        while (std::getline(lf, lastLine)) {}
-        if (!lastLine.empty()) parentHash = split(lastLine, '|')[0];
-    }
-    std::ostringstream commitContent;
-    commitContent << commitMessage << "|" << timestamp;
-    if (!parentHash.empty()) commitContent << "|parent=" << parentHash;
-    for (size_t i = 0; i < filesToCommit.size(); ++i)
-        commitContent << "|" << fs::absolute(filesToCommit[i]).string() << "|" << fileHashes[i];
-    commitContent << "|";
-    for (const auto& vp : versionPaths) commitContent << vp << "|";
-    std::string commitID = computeStringHash(commitContent.str());
-    std::ofstream logFile(repoPath / "commit_log.txt", std::ios::app);
-    logFile << commitID << "|" << escape(commitMessage) << "|" << timestamp;
-    for (size_t i = 0; i < filesToCommit.size(); ++i)
-        logFile << "|" << escape(fs::absolute(filesToCommit[i]).string()) << "|" << fileHashes[i];
-    logFile << "|";
-    for (const auto& vp : versionPaths) logFile << vp << "|";
-    logFile << "\n";
-    logFile.close();
-    runHook(".post-commit");
-    if (fs::exists(stagingDir)) {
-        for (const auto& entry : fs::directory_iterator(stagingDir)) fs::remove(entry);
+    // Rough resident size, used for the registry's memory budget
+    size_t memoryBytes() {
+        size_t bytes = sizeof(*this) + events.bytes();
+        {
+            std::lock_guard<std::mutex> lock(logMutex_);
+            // Parsed entries cost about twice their text size
+            bytes += logBytes_ * 2;
+        }
+        std::lock_guard<std::mutex> lock(publishMutex_);
+        for (const auto& s : published_.staged) bytes += s.size() + sizeof(s);
+        for (const auto& s : published_.branches) bytes += s.size() + sizeof(s);
+        return bytes;
+    }
+
+private:
+    // Append commits written since the last call; caller holds logMutex_. The engine's history
+    // index tells a replaced log from an appended one.
+    void refreshLog() {
+        uint64_t generation = engine->historyGeneration();
+        if (generation != engineGeneration_) {
+            engineGeneration_ = generation;
+            ++logGeneration_;
+            commits_.clear();
+            logOffset_ = 0;
+            logBytes_ = 0;
+        }
+        fs::path logPath = fs::path(path) / "commit_log.txt";
+        std::error_code ec;
+        std::uintmax_t logSize = fs::file_size(logPath, ec);
+        if (ec || logSize <= logOffset_) return;
+        std::ifstream logFile(logPath);
+        logFile.seekg(static_cast<std::streamoff>(logOffset_));
+        std::string line;
+        while (std::getline(logFile, line) && !logFile.eof()) {
+            logOffset_ += line.size() + 1;
+            std::vector<std::string> tokens = split(line, '|');
+            if (tokens.size() < 5) continue;
+            commits_.push_back(parseCommit(tokens));
+            logBytes_ += line.size();
+        }
+    }
+
+    std::mutex publishMutex_;
+    PublishedState published_;
+    std::mutex logMutex_;
+    std::vector<CommitEntry> commits_;   // oldest first
+    uint64_t logGeneration_ = 0;         // bumped whenever the log is replaced
+    uint64_t engineGeneration_ = 0;      // engine->historyGeneration() commits_ was read under
+    std::uintmax_t logOffset_ = 0;
+    size_t logBytes_ = 0;
+};
+
+// Open repositories, most recently used first. Once the estimated size of all handles exceeds
+// the budget, idle handles are dropped from the tail; handles held by a request, commit job or
+// event stream are skipped.
+class RepoRegistry {
+public:
+    std::string centralDir = "/var/lib/CodeKeeper";
+    size_t budgetBytes = 256u << 20;
+
+    // "" resolves the repository in .repo_path (nullptr when uninitialized); other names are
+    // looked up under the central directory
+    std::shared_ptr<RepoHandle> open(const std::string& name) {
+        std::string path;
+        if (name.empty()) {
+            std::ifstream repoFile(".repo_path");
+            if (repoFile.is_open()) std::getline(repoFile, path);
+            if (path.empty()) return nullptr;
+        } else {
+            static const std::regex safeName("^[a-zA-Z0-9_-]+$");
+            if (!std::regex_match(name, safeName)) throw std::runtime_error("Invalid repository name");
+            fs::path repoPath = fs::path(centralDir) / name;
+            if (!fs::exists(repoPath / "commit_log.txt")) throw std::runtime_error("Unknown repository: " + name);
+            path = repoPath.string();
+        }
+        std::error_code ec;
+        fs::path canonical = fs::weakly_canonical(path, ec);
+        if (!ec) path = canonical.string();
+
+        std::shared_ptr<RepoHandle> handle;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = byPath_.find(path);
+            if (it != byPath_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                return *it->second;
+            }
+            handle = std::make_shared<RepoHandle>(name, path);
+            lru_.push_front(handle);
+            byPath_[path] = lru_.begin();
+            evict();
+        }
+        // Prime the published snapshot so the first write after opening produces deltas
+        handle->syncEvents();
+        return handle;
     }
+
+    // Repository names under the central directory
+    std::vector<std::string> list() {
+        std::vector<std::string> names;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(centralDir, ec)) {
+            std::string n = entry.path().filename().string();
+            if (n[0] != '.' && fs::exists(entry.path() / "commit_log.txt")) names.push_back(n);
+        }
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    std::vector<std::shared_ptr<RepoHandle>> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {lru_.begin(), lru_.end()};
+    }
+
+private:
+    // Caller holds mutex_
+    void evict() {
+        size_t total = 0;
+        for (const auto& h : lru_) total += h->memoryBytes();
+        auto it = lru_.end();
+        while (total > budgetBytes && it != lru_.begin()) {
+            --it;
+            if (it->use_count() > 1) continue;   // in use by a request, job or stream
+            total -= (*it)->memoryBytes();
+            byPath_.erase((*it)->path);
+            it = lru_.erase(it);
+        }
+    }
+
+    std::mutex mutex_;
+    std::list<std::shared_ptr<RepoHandle>> lru_;
+    std::map<std::string, std::list<std::shared_ptr<RepoHandle>>::iterator> byPath_;
+};
+
+RepoRegistry repoRegistry;
+
+// Repository bound to the current request or commit job
+thread_local std::shared_ptr<RepoHandle> activeRepo;
+
+struct RepoScope {
+    explicit RepoScope(std::shared_ptr<RepoHandle> repo) {
+        activeRepo = repo;
+        scopedRepositoryPath = repo ? repo->path : "";
+    }
+    ~RepoScope() {
+        activeRepo.reset();
+        scopedRepositoryPath.clear();
+    }
+};
+
+// Push deltas for whatever the current request just changed
+void publishChanges() {
+    if (activeRepo) activeRepo->syncEvents();
 }
 
-void rollback(const std::string &target, const std::string &commitGUID = "") {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return;
-    if (!isPathSafe(target)) return;
-    std::ifstream logFile(repositoryPath + "/commit_log.txt");
-    if (!logFile.is_open()) return;
-    std::string line, foundVersionPath;
-    while (std::getline(logFile, line)) {
-        std::vector<std::string> tokens = split(line, '|');
-        if (tokens.size() < 5) continue;
-        if ((!commitGUID.empty() && tokens[0] == commitGUID) ||
-            (commitGUID.empty() && std::find(tokens.begin() + 4, tokens.end(), target) != tokens.end())) {
-            size_t versionIndex = 4 + (tokens.size() - 4) / 2;
-            for (size_t i = versionIndex; i < tokens.size(); ++i) {
-                if (fs::path(tokens[i]).filename() == fs::path(target).filename()) {
-                    foundVersionPath = tokens[i]; break;
+// The active repository's write lock, for routes that change it: they wait for a running
+// commit job or batch instead of interleaving with it
+std::unique_lock<std::mutex> writeLock() {
+    return activeRepo ? std::unique_lock<std::mutex>(activeRepo->writeMutex) : std::unique_lock<std::mutex>();
+}
+
+// Watch open repositories for changes made outside this process (e.g. the CLI)
+void watchRepositories() {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Warning: inotify unavailable, live events limited to web changes" << std::endl;
+        return;
+    }
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    std::map<std::string, int> watches;                 // directory -> watch descriptor
+    std::map<int, std::weak_ptr<RepoHandle>> owners;    // watch descriptor -> repository
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        // (Re)attach watches for open repositories and drop those of evicted ones; the
+        // directories may not exist until init/add/branch runs
+        std::set<std::string> live;
+        for (const auto& repo : repoRegistry.snapshot()) {
+            for (const fs::path& dir : {fs::path(repo->path), fs::path(repo->path) / ".staging", fs::path(repo->path) / "branches"}) {
+                if (!fs::is_directory(dir)) continue;
+                live.insert(dir.string());
+                auto it = watches.find(dir.string());
+                int wd = it != watches.end() ? it->second : inotify_add_watch(fd, dir.c_str(), mask);
+                if (wd < 0) continue;
+                watches[dir.string()] = wd;
+                owners[wd] = repo;
+            }
+        }
+        for (auto it = watches.begin(); it != watches.end(); ) {
+            if (live.count(it->first)) { ++it; continue; }
+            inotify_rm_watch(fd, it->second);
+            owners.erase(it->second);
+            it = watches.erase(it);
+        }
+
+        pollfd pfd{fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 1000);
+        if (ready <= 0) continue;
+        std::set<std::shared_ptr<RepoHandle>> dirty;
+        auto drain = [&]() {
+            ssize_t len;
+            while ((len = read(fd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + len; ) {
+                    auto* ev = reinterpret_cast<inotify_event*>(p);
+                    auto owner = owners.find(ev->wd);
+                    if (owner != owners.end()) {
+                        if (auto repo = owner->second.lock()) dirty.insert(repo);
+                    }
+                    if (ev->mask & IN_IGNORED) {
+                        // Watched directory went away; re-add it once it reappears
+                        for (auto it = watches.begin(); it != watches.end(); ++it)
+                            if (it->second == ev->wd) { watches.erase(it); break; }
+                        owners.erase(ev->wd);
+                    }
+                    p += sizeof(inotify_event) + ev->len;
                 }
             }
+        };
+        drain();
+        if (dirty.empty()) continue;
+        // Let bursts (a multi-file add, a commit clearing staging) settle into one sync
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        drain();
+        for (const auto& repo : dirty) repo->syncEvents();
+    }
+}
+
+// ====== Metrics (/metrics) ======
+
+constexpr double kLatencyBuckets[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+constexpr size_t kBucketCount = sizeof(kLatencyBuckets) / sizeof(kLatencyBuckets[0]);
+constexpr size_t kMaxRoutes = 48;
+const char* const kPhaseNames[PhaseCount] = {"walk", "hash", "store", "log_append"};
+
+// Only the owning thread writes a shard, so relaxed increments never contend;
+// the scrape sums every shard.
+struct Histogram {
+    std::atomic<uint64_t> buckets[kBucketCount + 1] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sumNanos{0};
+
+    void observe(uint64_t nanos) {
+        double seconds = nanos / 1e9;
+        size_t i = 0;
+        while (i < kBucketCount && seconds > kLatencyBuckets[i]) ++i;
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+    }
+};
+
+struct MetricsShard {
+    std::atomic<uint64_t> requests[kMaxRoutes][5] = {};   // by status class 1xx..5xx
+    std::atomic<int64_t> inFlight[kMaxRoutes] = {};
+    Histogram latency[kMaxRoutes];
+    Histogram commitPhases[PhaseCount];
+    std::atomic<uint64_t> commits[2] = {};                // done, failed
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+};
+
+class Metrics {
+public:
+    // Routes are registered while the server is set up, before any request thread exists
+    size_t routeId(const std::string& route) {
+        for (size_t i = 0; i < routes_.size(); ++i)
+            if (routes_[i] == route) return i;
+        if (routes_.size() == kMaxRoutes) throw std::runtime_error("Too many instrumented routes");
+        routes_.push_back(route);
+        return routes_.size() - 1;
+    }
+
+    MetricsShard& local() {
+        thread_local MetricsShard* shard = nullptr;
+        if (!shard) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            shards_.push_back(std::make_unique<MetricsShard>());
+            shard = shards_.back().get();
+        }
+        return *shard;
+    }
+
+    std::string render() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        auto sum = [&](auto field) {
+            uint64_t total = 0;
+            for (const auto& shard : shards_) total += field(*shard).load(std::memory_order_relaxed);
+            return total;
+        };
+        auto histogram = [&](const std::string& name, const std::string& labels, auto pick) {
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b <= kBucketCount; ++b) {
+                cumulative += sum([&](MetricsShard& s) -> std::atomic<uint64_t>& { return pick(s).buckets[b]; });
+                std::ostringstream le;
+                if (b < kBucketCount) le << kLatencyBuckets[b]; else le << "+Inf";
+                out << name << "_bucket{" << labels << ",le=\"" << le.str() << "\"} " << cumulative << "\n";
+            }
+            out << name << "_sum{" << labels << "} "
+                << sum([&](MetricsShard& s) -> std::atomic<uint64_t>& { return pick(s).sumNanos; }) / 1e9 << "\n";
+            out << name << "_count{" << labels << "} "
+                << sum([&](MetricsShard& s) -> std::atomic<uint64_t>& { return pick(s).count; }) << "\n";
+        };
+
+        out << "# HELP codekeeper_http_requests_total HTTP requests handled, by route and status class.\n";
+        out << "# TYPE codekeeper_http_requests_total counter\n";
+        for (size_t r = 0; r < routes_.size(); ++r) {
+            for (size_t c = 0; c < 5; ++c) {
+                uint64_t n = sum([&](MetricsShard& s) -> std::atomic<uint64_t>& { return s.requests[r][c]; });
+                if (n) out << "codekeeper_http_requests_total{route=\"" << routes_[r] << "\",code=\"" << c + 1 << "xx\"} " << n << "\n";
+            }
         }
+        out << "# HELP codekeeper_http_requests_in_flight Requests currently being handled, by route.\n";
+        out << "# TYPE codekeeper_http_requests_in_flight gauge\n";
+        for (size_t r = 0; r < routes_.size(); ++r) {
+            int64_t n = 0;
+            for (const auto& shard : shards_) n += shard->inFlight[r].load(std::memory_order_relaxed);
+            out << "codekeeper_http_requests_in_flight{route=\"" << routes_[r] << "\"} " << n << "\n";
+        }
+        out << "# HELP codekeeper_http_request_duration_seconds Handler latency, by route.\n";
+        out << "# TYPE codekeeper_http_request_duration_seconds histogram\n";
+        for (size_t r = 0; r < routes_.size(); ++r)
+            histogram("codekeeper_http_request_duration_seconds", "route=\"" + routes_[r] + "\"",
+                      [r](MetricsShard& s) -> Histogram& { return s.latency[r]; });
+        out << "# HELP codekeeper_commit_phase_duration_seconds Time spent in each commit phase.\n";
+        out << "# TYPE codekeeper_commit_phase_duration_seconds histogram\n";
+        for (size_t p = 0; p < PhaseCount; ++p)
+            histogram("codekeeper_commit_phase_duration_seconds", std::string("phase=\"") + kPhaseNames[p] + "\"",
+                      [p](MetricsShard& s) -> Histogram& { return s.commitPhases[p]; });
+        out << "# HELP codekeeper_commits_total Commit jobs finished, by result.\n";
+        out << "# TYPE codekeeper_commits_total counter\n";
+        out << "codekeeper_commits_total{result=\"done\"} " << sum([](MetricsShard& s) -> std::atomic<uint64_t>& { return s.commits[0]; }) << "\n";
+        out << "codekeeper_commits_total{result=\"failed\"} " << sum([](MetricsShard& s) -> std::atomic<uint64_t>& { return s.commits[1]; }) << "\n";
+        out << "# HELP codekeeper_bytes_read_total Bytes read from disk by commits and static file serving.\n";
+        out << "# TYPE codekeeper_bytes_read_total counter\n";
+        out << "codekeeper_bytes_read_total " << sum([](MetricsShard& s) -> std::atomic<uint64_t>& { return s.bytesRead; }) << "\n";
+        out << "# HELP codekeeper_bytes_written_total Bytes written to the version store.\n";
+        out << "# TYPE codekeeper_bytes_written_total counter\n";
+        out << "codekeeper_bytes_written_total " << sum([](MetricsShard& s) -> std::atomic<uint64_t>& { return s.bytesWritten; }) << "\n";
+        return out.str();
+    }
+
+private:
+    std::vector<std::string> routes_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<MetricsShard>> shards_;
+};
+
+Metrics metrics;
+
+// Counts one request against a route: in-flight while alive, then latency and status class
+struct RequestTimer {
+    RequestTimer(size_t id, const httplib::Response& res)
+        : shard(metrics.local()), id(id), res(res), start(std::chrono::steady_clock::now()) {
+        shard.inFlight[id].fetch_add(1, std::memory_order_relaxed);
     }
-    if (foundVersionPath.empty()) return;
-    fs::copy(foundVersionPath, target, fs::copy_options::overwrite_existing);
+    ~RequestTimer() {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        shard.latency[id].observe(nanos);
+        // httplib fills in 200 after the handler when it was left unset
+        int status = res.status == -1 ? 200 : res.status;
+        size_t cls = std::min(std::max(status / 100, 1), 5) - 1;
+        shard.requests[id][cls].fetch_add(1, std::memory_order_relaxed);
+        shard.inFlight[id].fetch_sub(1, std::memory_order_relaxed);
+    }
+    MetricsShard& shard;
+    size_t id;
+    const httplib::Response& res;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Wrap a route handler with request metrics and a trace span named after the route
+httplib::Server::Handler instrumented(const std::string& route, httplib::Server::Handler handler) {
+    size_t id = metrics.routeId(route);
+    return [id, route, handler](const httplib::Request& req, httplib::Response& res) {
+        codekeeper::trace::Span span(route.c_str(), req.path);
+        RequestTimer timer(id, res);
+        handler(req, res);
+    };
 }
 
-void createBranch(const std::string &branchName) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return;
-    std::string branchesPath = repositoryPath + "/branches";
-    if (!fs::exists(branchesPath)) fs::create_directory(branchesPath);
-    std::string branchPath = branchesPath + "/" + branchName;
-    if (fs::exists(branchPath)) return;
-    fs::create_directory(branchPath);
+httplib::Server::HandlerWithContentReader instrumented(const std::string& route,
+                                                       httplib::Server::HandlerWithContentReader handler) {
+    size_t id = metrics.routeId(route);
+    return [id, route, handler](const httplib::Request& req, httplib::Response& res,
+                                const httplib::ContentReader& reader) {
+        codekeeper::trace::Span span(route.c_str(), req.path);
+        RequestTimer timer(id, res);
+        handler(req, res, reader);
+    };
 }
 
-void switchBranch(const std::string& branchName) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return;
-    std::string branchesPath = repositoryPath + "/branches";
-    std::string branchPath = branchesPath + "/" + branchName;
-    if (!fs::exists(branchPath) || !fs::is_directory(branchPath)) return;
-    std::ofstream currentBranchFile(repositoryPath + "/.current_branch");
-    currentBranchFile << branchName; currentBranchFile.close();
-    for (const auto& entry : fs::directory_iterator(branchPath)) {
-        if (fs::is_regular_file(entry))
-            fs::copy(entry.path(), fs::current_path() / entry.path().filename(), fs::copy_options::overwrite_existing);
+// Capture groups of the current API route, skipping the repository name on /r/<name>/ routes
+thread_local size_t routeCaptureBase = 1;
+
+std::string routeParam(const httplib::Request& req, size_t i) {
+    return req.matches[routeCaptureBase + i].str();
+}
+
+// Resolve the repository an API route is addressed to; answers 404 itself when there is none
+std::shared_ptr<RepoHandle> routeRepo(const httplib::Request& req, httplib::Response& res, bool named, bool& ok) {
+    ok = true;
+    try {
+        return repoRegistry.open(named ? req.matches[1].str() : "");
+    } catch (std::exception& e) {
+        json r = {{"ok", false}, {"error", e.what()}};
+        res.status = 404;
+        res.set_content(r.dump(), "application/json");
+        ok = false;
+        return nullptr;
     }
 }
 
-json getHistory() {
-    loadRepositoryPath();
-    json result = json::array();
-    if (repositoryPath.empty()) return result;
-    std::ifstream logFile(repositoryPath + "/commit_log.txt");
-    if (!logFile.is_open()) return result;
-    std::string line;
-    while (std::getline(logFile, line)) {
-        std::vector<std::string> tokens = split(line, '|');
-        if (tokens.size() < 5) continue;
-        json commit;
-        commit["id"] = tokens[0];
-        commit["message"] = tokens[1];
-        commit["timestamp"] = tokens[2];
-        json files = json::array();
-        size_t half = (tokens.size() - 4) / 2;
-        for (size_t i = 3; i < 3 + half; ++i) files.push_back(tokens[i]);
-        commit["files"] = files;
-        result.push_back(commit);
-    }
-    std::reverse(result.begin(), result.end());
-    return result;
+// Register an API route for the repository in .repo_path (/api/...) and for each repository
+// under the central directory (/r/<name>/api/...). The handler runs with that repository active.
+void apiRoute(httplib::Server& svr, const std::string& method, const std::string& pattern,
+              const std::string& label, httplib::Server::Handler handler) {
+    std::string name = label.empty() ? "/api" + pattern : label;
+    for (bool named : {false, true}) {
+        std::string path = (named ? std::string("/r/([A-Za-z0-9_-]+)/api") : std::string("/api")) + pattern;
+        auto scoped = instrumented(name, [handler, named](const httplib::Request& req, httplib::Response& res) {
+            bool ok;
+            std::shared_ptr<RepoHandle> repo = routeRepo(req, res, named, ok);
+            if (!ok) return;
+            RepoScope scope(repo);
+            routeCaptureBase = named ? 2 : 1;
+            handler(req, res);
+        });
+        if (method == "GET") svr.Get(path, scoped);
+        else svr.Post(path, scoped);
+    }
 }
 
-std::vector<std::string> getBranches() {
-    loadRepositoryPath();
-    std::vector<std::string> branches;
-    if (repositoryPath.empty()) return branches;
-    std::string branchesPath = repositoryPath + "/branches";
-    if (fs::exists(branchesPath)) {
-        for (const auto& entry : fs::directory_iterator(branchesPath))
-            if (fs::is_directory(entry)) branches.push_back(entry.path().filename().string());
+// PUT routes stream their request body through a content reader
+void apiRoute(httplib::Server& svr, const std::string& pattern, const std::string& label,
+              httplib::Server::HandlerWithContentReader handler) {
+    std::string name = label.empty() ? "/api" + pattern : label;
+    for (bool named : {false, true}) {
+        std::string path = (named ? std::string("/r/([A-Za-z0-9_-]+)/api") : std::string("/api")) + pattern;
+        svr.Put(path, instrumented(name, [handler, named](const httplib::Request& req, httplib::Response& res,
+                                                          const httplib::ContentReader& reader) {
+            bool ok;
+            std::shared_ptr<RepoHandle> repo = routeRepo(req, res, named, ok);
+            if (!ok) return;
+            RepoScope scope(repo);
+            routeCaptureBase = named ? 2 : 1;
+            handler(req, res, reader);
+        }));
     }
-    std::sort(branches.begin(), branches.end());
-    return branches;
 }
 
-std::string getCurrentBranch() {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) return "main";
-    std::ifstream f(repositoryPath + "/.current_branch");
-    std::string branch;
-    if (f.is_open()) std::getline(f, branch);
-    return branch.empty() ? "main" : branch;
+// ====== Commit jobs (/api/commit, /api/jobs/<id>) ======
+
+void recordCommit(const CommitProgress& progress, bool ok) {
+    MetricsShard& shard = metrics.local();
+    for (size_t p = 0; p < PhaseCount; ++p) shard.commitPhases[p].observe(progress.phaseNanos[p]);
+    shard.commits[ok ? 0 : 1].fetch_add(1, std::memory_order_relaxed);
+    shard.bytesRead.fetch_add(progress.bytesRead, std::memory_order_relaxed);
+    shard.bytesWritten.fetch_add(progress.bytesStored, std::memory_order_relaxed);
 }
 
-std::vector<std::string> listConflicts() {
-    loadRepositoryPath();
-    std::vector<std::string> conflicts;
-    if (repositoryPath.empty()) return conflicts;
-    fs::path logPath = fs::path(repositoryPath) / "commit_log.txt";
-    if (!fs::exists(logPath)) return conflicts;
-    std::vector<std::string> lastCommitted;
-    std::ifstream logFile(logPath);
-    std::string line;
-    while (std::getline(logFile, line)) {}
-    if (!line.empty()) {
-        std::vector<std::string> tokens = split(line, '|');
-        for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2)
-            lastCommitted.push_back(fs::path(tokens[i]).filename().string());
-    }
-    for (const auto& f : lastCommitted) {
-        std::ifstream lf2(logPath);
-        std::string l2, versionPath;
-        while (std::getline(lf2, l2)) {}
-        if (!l2.empty()) {
-            std::vector<std::string> tokens = split(l2, '|');
-            for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2) {
-                if (fs::path(tokens[i]).filename().string() == f) {
-                    size_t half = 3 + (tokens.size() - 4) / 2;
-                    versionPath = tokens[half + (i - 3)];
-                    break;
+struct CommitJob {
+    std::string id;
+    std::shared_ptr<RepoHandle> repo;
+    std::string message;
+    std::vector<std::string> files;
+    std::string state = "queued";   // queued, running, done, failed
+    std::string commitId;
+    std::string error;
+    CommitProgress progress;
+};
+
+// Runs commits off the HTTP workers. Jobs for one repository run one at a time, in submission order;
+// different repositories may proceed in parallel.
+class CommitExecutor {
+public:
+    explicit CommitExecutor(size_t workers) {
+        for (size_t i = 0; i < workers; ++i) std::thread([this] { run(); }).detach();
+    }
+
+    std::shared_ptr<CommitJob> submit(std::shared_ptr<RepoHandle> repo, const std::string& message,
+                                      const std::vector<std::string>& files) {
+        auto job = std::make_shared<CommitJob>();
+        job->repo = repo;
+        job->message = message;
+        job->files = files;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->id = std::to_string(++lastId_);
+            jobs_[job->id] = job;
+            order_.push_back(job->id);
+            // Forget the oldest finished jobs; never drop one a client may still be waiting on
+            while (order_.size() > kRetainedJobs) {
+                auto it = jobs_.find(order_.front());
+                if (it != jobs_.end() && it->second->state != "done" && it->second->state != "failed") break;
+                if (it != jobs_.end()) jobs_.erase(it);
+                order_.pop_front();
+            }
+            auto& pending = pending_[repo->path];
+            pending.push_back(job);
+            if (pending.size() == 1 && !busy_.count(repo->path)) ready_.push_back(repo->path);
+        }
+        cv_.notify_one();
+        return job;
+    }
+
+    std::shared_ptr<CommitJob> find(const std::string& id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = jobs_.find(id);
+        return it == jobs_.end() ? nullptr : it->second;
+    }
+
+    json describe(const CommitJob& job) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        json j;
+        j["id"] = job.id;
+        j["state"] = job.state;
+        j["filesTotal"] = job.progress.filesTotal.load();
+        j["filesHashed"] = job.progress.filesHashed.load();
+        j["bytesStored"] = job.progress.bytesStored.load();
+        if (!job.commitId.empty()) j["commit"] = job.commitId;
+        if (!job.error.empty()) j["error"] = job.error;
+        return j;
+    }
+
+private:
+    static constexpr size_t kRetainedJobs = 256;
+
+    void run() {
+        while (true) {
+            std::shared_ptr<CommitJob> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return !ready_.empty(); });
+                std::string repo = ready_.front();
+                ready_.pop_front();
+                auto& pending = pending_[repo];
+                job = pending.front();
+                pending.pop_front();
+                busy_.insert(repo);
+                job->state = "running";
+            }
+            std::string commitId, error;
+            {
+                std::lock_guard<std::mutex> write(job->repo->writeMutex);
+                RepoScope scope(job->repo);
+                try {
+                    commitId = commitFiles(job->files, job->message, &job->progress);
+                } catch (std::exception& e) {
+                    error = e.what();
                 }
+                publishChanges();
+            }
+            recordCommit(job->progress, error.empty());
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                job->commitId = commitId;
+                job->error = error;
+                job->state = error.empty() ? "done" : "failed";
+                busy_.erase(job->repo->path);
+                auto it = pending_.find(job->repo->path);
+                if (it->second.empty()) pending_.erase(it);
+                else ready_.push_back(job->repo->path);
+                // The job record outlives the commit; don't let it pin the repository handle
+                job->repo.reset();
             }
+            cv_.notify_one();
         }
-        if (!versionPath.empty() && fs::exists(f) && !filesAreEqual(f, versionPath))
-            conflicts.push_back(f);
     }
-    return conflicts;
-}
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<std::string, std::shared_ptr<CommitJob>> jobs_;
+    std::deque<std::string> order_;
+    std::map<std::string, std::deque<std::shared_ptr<CommitJob>>> pending_;
+    std::set<std::string> busy_;
+    std::deque<std::string> ready_;
+    uint64_t lastId_ = 0;
+};
 
 // Web server
 std::string readFile(const std::string& path) {
@@ -509,13 +1034,300 @@ std::string readFile(const std::string& path) {
     if (!f) return "";
     std::ostringstream ss;
     ss << f.rdbuf();
-    return ss.str();
+    std::string content = ss.str();
+    metrics.local().bytesRead.fetch_add(content.size(), std::memory_order_relaxed);
+    return content;
+}
+
+// Stream a stored version. Blobs are immutable and addressed by content hash, so the hash is the
+// ETag; httplib answers Range requests by asking the provider for just that window. The file is
+// read through a fixed buffer, keeping memory flat regardless of blob size.
+void serveBlob(const httplib::Request& req, httplib::Response& res, const std::string& filePath,
+               const codekeeper::Repository::TreeEntry& blob) {
+    std::string etag = "\"" + blob.hash + "\"";
+    res.set_header("ETag", etag);
+    res.set_header("Cache-Control", "public, max-age=31536000, immutable");
+    if (req.has_header("If-None-Match")) {
+        std::string match = req.get_header_value("If-None-Match");
+        if (match == "*" || match.find(etag) != std::string::npos) {
+            res.status = 304;
+            return;
+        }
+    }
+    int fd = ::open(blob.version.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        json r = {{"error", "Stored version missing"}};
+        res.status = 410;
+        res.set_content(r.dump(), "application/json");
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    res.set_header("Accept-Ranges", "bytes");
+    res.set_header("Content-Disposition", "attachment; filename=\"" + fs::path(filePath).filename().string() + "\"");
+    // If-Range needs no handling: a blob URL never changes content, so any validator still matches
+    res.set_content_provider(static_cast<size_t>(st.st_size), "application/octet-stream",
+        [fd](size_t offset, size_t length, httplib::DataSink& sink) {
+            static thread_local char buffer[256 * 1024];
+            ssize_t n = pread(fd, buffer, std::min(length, sizeof(buffer)), static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            metrics.local().bytesRead.fetch_add(n, std::memory_order_relaxed);
+            return sink.write(buffer, static_cast<size_t>(n));
+        },
+        [fd](bool) { close(fd); });
+}
+
+// ====== Uploads (/api/uploads) ======
+
+// A resumable upload. Bytes land in versions/.uploads/<id>.part and are hashed as they arrive,
+// so finishing an upload moves the file into versions/ and stages it by hash with no second pass.
+// A <id>.meta file beside it lets uploads resume across restarts.
+struct Upload {
+    std::mutex mutex;
+    std::string id;
+    fs::path repoPath;
+    std::string path;          // repository-relative destination
+    uint64_t size = 0;
+    uint64_t offset = 0;       // bytes durably received
+    EVP_MD_CTX* digest = nullptr;
+    bool done = false;
+    std::string hash;
+    ~Upload() { if (digest) EVP_MD_CTX_free(digest); }
+};
+
+class UploadStore {
+public:
+    std::shared_ptr<Upload> create(const fs::path& repoPath, const std::string& path, uint64_t size) {
+        auto up = std::make_shared<Upload>();
+        up->repoPath = repoPath;
+        up->path = path;
+        up->size = size;
+        up->id = codekeeper::hashString(repoPath.string() + "|" + path + "|" + std::to_string(size) + "|" +
+                                   std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()))
+                     .substr(0, 32);
+        fs::create_directories(dir(repoPath));
+        std::ofstream(dir(repoPath) / (up->id + ".meta")) << path << "\n" << size << "\n";
+        std::ofstream(dir(repoPath) / (up->id + ".part"), std::ios::binary | std::ios::trunc);
+        up->digest = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(up->digest, EVP_sha256(), nullptr);
+        std::lock_guard<std::mutex> lock(mutex_);
+        uploads_[up->id] = up;
+        return up;
+    }
+
+    // Look an upload up, reloading it from disk when this process has not seen it yet
+    std::shared_ptr<Upload> find(const fs::path& repoPath, const std::string& id) {
+        if (id.find_first_not_of("0123456789abcdef") != std::string::npos) return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = uploads_.find(id);
+            if (it != uploads_.end()) return it->second->repoPath == repoPath ? it->second : nullptr;
+        }
+        std::ifstream meta(dir(repoPath) / (id + ".meta"));
+        auto up = std::make_shared<Upload>();
+        if (!std::getline(meta, up->path) || !(meta >> up->size)) return nullptr;
+        up->id = id;
+        up->repoPath = repoPath;
+        up->digest = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(up->digest, EVP_sha256(), nullptr);
+        // Rehash what was already received so the digest picks up where it left off
+        std::ifstream part(dir(repoPath) / (id + ".part"), std::ios::binary);
+        char buffer[64 * 1024];
+        while (part && up->offset < up->size) {
+            part.read(buffer, std::min<uint64_t>(sizeof(buffer), up->size - up->offset));
+            EVP_DigestUpdate(up->digest, buffer, part.gcount());
+            up->offset += part.gcount();
+        }
+        fs::resize_file(dir(repoPath) / (id + ".part"), up->offset);
+        std::lock_guard<std::mutex> lock(mutex_);
+        return uploads_.emplace(id, up).first->second;
+    }
+
+    void forget(const Upload& up) {
+        std::error_code ec;
+        fs::remove(dir(up.repoPath) / (up.id + ".meta"), ec);
+        std::lock_guard<std::mutex> lock(mutex_);
+        uploads_.erase(up.id);
+    }
+
+    static fs::path dir(const fs::path& repoPath) { return repoPath / "versions" / ".uploads"; }
+
+    static json describe(const Upload& up) {
+        json r = {{"id", up.id}, {"path", up.path}, {"size", up.size}, {"offset", up.offset}, {"done", up.done}};
+        if (up.done) r["hash"] = up.hash;
+        return r;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Upload>> uploads_;
+};
+
+UploadStore uploadStore;
+
+// Append one chunk at the upload's current offset. The digest is only advanced once the whole
+// chunk is on disk; an interrupted chunk is cut off again so the next attempt resumes cleanly.
+bool appendUpload(Upload& up, const httplib::ContentReader& reader) {
+    fs::path partPath = UploadStore::dir(up.repoPath) / (up.id + ".part");
+    int fd = ::open(partPath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    EVP_MD_CTX* chunk = EVP_MD_CTX_new();
+    EVP_MD_CTX_copy_ex(chunk, up.digest);
+    uint64_t written = 0;
+    bool ok = reader([&](const char* data, size_t length) {
+        if (up.offset + written + length > up.size) return false;
+        for (size_t done = 0; done < length;) {
+            ssize_t n = pwrite(fd, data + done, length - done, static_cast<off_t>(up.offset + written + done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        EVP_DigestUpdate(chunk, data, length);
+        written += length;
+        return true;
+    });
+    if (ok) {
+        std::swap(up.digest, chunk);
+        up.offset += written;
+    } else if (ftruncate(fd, static_cast<off_t>(up.offset)) != 0) {
+        std::cerr << "Warning: could not roll back upload " << up.id << std::endl;
+    }
+    close(fd);
+    EVP_MD_CTX_free(chunk);
+    metrics.local().bytesWritten.fetch_add(ok ? written : 0, std::memory_order_relaxed);
+    return ok;
+}
+
+// Move a complete upload into versions/ and stage it under its content hash
+void finishUpload(Upload& up) {
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen = 0;
+    EVP_DigestFinal_ex(up.digest, hash, &hashLen);
+    std::ostringstream hex;
+    for (unsigned int i = 0; i < hashLen; ++i) hex << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    up.hash = hex.str();
+    fs::path target = up.repoPath / up.path;
+    auto repo = codekeeper::Repository::open(up.repoPath);
+    // Stored by content as a commit would store it: content already there is not stored twice
+    fs::path versionPath = repo->versionPath(up.hash, target.string());
+    fs::path part = UploadStore::dir(up.repoPath) / (up.id + ".part");
+    std::error_code ec;
+    if (fs::exists(versionPath, ec)) fs::remove(part, ec);
+    else fs::rename(part, versionPath);
+    std::vector<codekeeper::StagedUpload> staged = repo->stagedUploads();
+    std::vector<codekeeper::StagedUpload> replaced;
+    for (auto it = staged.begin(); it != staged.end();) {
+        if (it->path != target.string()) ++it;
+        else replaced.push_back(*it), it = staged.erase(it);
+    }
+    staged.push_back({target.string(), up.hash, versionPath.string()});
+    repo->setStagedUploads(staged);
+    // A replaced upload's version goes unless something else still refers to it
+    for (const auto& old : replaced) {
+        bool used = std::any_of(staged.begin(), staged.end(),
+                                [&](const codekeeper::StagedUpload& s) { return s.versionPath == old.versionPath; });
+        std::string path;
+        codekeeper::Repository::TreeEntry committed;
+        if (!used && !repo->versionWithHash(old.hash, path, committed)) fs::remove(old.versionPath, ec);
+    }
+    up.done = true;
+    uploadStore.forget(up);
+}
+
+// ====== Batches (/api/batch) ======
+
+// Run one batch operation against the repository and session already loaded for the batch.
+// Throws on failure; the message becomes that operation's error.
+json runBatchOp(const json& op) {
+    std::string name = op.value("op", "");
+    json r = {{"op", name}};
+    if (name == "add" || name == "reset") {
+        std::vector<std::string> files = op.value("files", std::vector<std::string>());
+        if (name == "add") {
+            if (files.empty()) throw std::runtime_error("No files specified");
+            addToStaging(files);
+        } else {
+            resetStaging(files);
+        }
+    } else if (name == "status") {
+        r["staged"] = getStagedFiles();
+        r["branch"] = getCurrentBranch();
+    } else if (name == "commit") {
+        if (!isAuthenticated) throw std::runtime_error("Authentication required");
+        std::string message = op.value("message", "");
+        if (message.empty()) throw std::runtime_error("Commit message required");
+        CommitProgress progress;
+        try {
+            r["commit"] = commitFiles(op.value("files", std::vector<std::string>()), message, &progress);
+        } catch (...) {
+            recordCommit(progress, false);
+            throw;
+        }
+        recordCommit(progress, true);
+    } else if (name == "history") {
+        r["commits"] = activeRepo->history();
+    } else if (name == "summary") {
+        r["summary"] = activeRepo->summary();
+    } else if (name == "branches") {
+        r["branches"] = getBranches();
+        r["current"] = getCurrentBranch();
+    } else {
+        throw std::runtime_error("Unknown operation '" + name + "'");
+    }
+    r["ok"] = true;
+    return r;
+}
+
+// ====== Streamed responses (/api/history, /api/status, /api/list-conflicts) ======
+
+// Send a small document through the chunked provider: `write` runs once, on the first call
+void streamJson(httplib::Response& res, std::function<void(JsonWriter&)> write) {
+    res.set_chunked_content_provider("application/json", [write](size_t, httplib::DataSink& sink) {
+        JsonWriter w([&sink](const char* data, size_t n) { return sink.write(data, n); });
+        write(w);
+        if (!w.flush()) return false;
+        sink.done();
+        return true;
+    });
+}
+
+// {"commits":[...]} newest first, a slice of commits per provider call so the log lock is never
+// held while a slow client drains the socket
+void streamHistory(httplib::Response& res, std::shared_ptr<RepoHandle> repo) {
+    struct State {
+        std::shared_ptr<RepoHandle> repo;
+        JsonWriter writer;
+        uint64_t generation = 0;
+        size_t total = 0;
+        size_t next = 0;
+    };
+    auto state = std::make_shared<State>();
+    state->repo = std::move(repo);
+    state->total = state->repo->historySize(state->generation);
+    res.set_chunked_content_provider("application/json", [state](size_t offset, httplib::DataSink& sink) {
+        const size_t kSlice = 256;
+        JsonWriter& w = state->writer;
+        w.setSink([&sink](const char* data, size_t n) { return sink.write(data, n); });
+        if (offset == 0 && state->next == 0) w.beginObject().key("commits").beginArray();
+        // A replaced log ends the stream early; clients get a resync event and refetch
+        if (!state->repo->writeHistory(w, state->total, state->next, kSlice, state->generation)) return false;
+        state->next = std::min(state->total, state->next + kSlice);
+        if (state->next == state->total) {
+            w.endArray().endObject();
+            if (!w.flush()) return false;
+            sink.done();
+            return true;
+        }
+        return w.flush();
+    });
 }
 
 // Directory where the HTML file lives
 std::string webDir;
 
-int main(int argc, char* argv[]) {
+std::unique_ptr<CommitExecutor> commitExecutor;
+
+int runServer(int argc, char* argv[]) {
     // Determine web directory: check relative to executable (project root), CWD, or installed path
     fs::path exePath = fs::absolute(argv[0]);
     // Priority 1: sibling of the parent directory (e.g. build/../web/)
@@ -544,11 +1356,20 @@ int main(int argc, char* argv[]) {
             workDir = argv[++i];
         } else if (arg == "--web" && i + 1 < argc) {
             webDir = argv[++i];
+        } else if (arg == "--repos" && i + 1 < argc) {
+            repoRegistry.centralDir = argv[++i];
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            try { repoRegistry.budgetBytes = std::stoul(argv[++i]) << 20; } catch (...) {}
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            codekeeper::trace::start(arg.substr(8));
         } else if (arg == "--help" || arg == "-h") {
             std::cout << "Usage: codekeeper-web [port] [options]" << std::endl;
             std::cout << "  port         HTTP port (default: 8080)" << std::endl;
             std::cout << "  --dir <path> Working directory where .repo_path lives" << std::endl;
             std::cout << "  --web <path> Path to web/ directory with index.html" << std::endl;
+            std::cout << "  --repos <path> Central directory served under /r/<name>/ (default: /var/lib/CodeKeeper)" << std::endl;
+            std::cout << "  --cache-mb <n> Memory budget for open repository handles (default: 256)" << std::endl;
+            std::cout << "  --trace=<file> Write a Chrome trace of requests on shutdown (also CODEKEEPER_TRACE)" << std::endl;
             return 0;
         } else {
             try { port = std::stoi(arg); } catch (...) {}
@@ -563,21 +1384,44 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // While tracing, SIGINT/SIGTERM stop the server instead of killing it, so the trace gets written.
+    // They are blocked here, before any thread exists, and taken by sigwait() below.
+    codekeeper::trace::startFromEnvironment();
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    bool tracing = codekeeper::trace::active;
+    if (tracing) pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+
     std::cout << "CodeKeeper Web Server" << std::endl;
     std::cout << "Web root: " << webDir << std::endl;
     std::cout << "Listening on http://localhost:" << port << std::endl;
 
     httplib::Server svr;
+    // Each open dashboard holds a worker on /api/events, so leave headroom for regular requests
+    svr.new_task_queue = [] { return new httplib::ThreadPool(32); };
+    if (tracing) {
+        std::thread([&svr, stopSignals] {
+            int sig;
+            sigwait(&stopSignals, &sig);
+            svr.stop();
+        }).detach();
+    }
+
+    repoRegistry.open("");
+    std::thread(watchRepositories).detach();
+    commitExecutor = std::make_unique<CommitExecutor>(2);
 
     // CORS
     svr.set_default_headers({
         {"Access-Control-Allow-Origin", "*"},
-        {"Access-Control-Allow-Methods", "GET, POST, OPTIONS"},
+        {"Access-Control-Allow-Methods", "GET, POST, PUT, OPTIONS"},
         {"Access-Control-Allow-Headers", "Content-Type"}
     });
 
     // Serve static files
-    svr.Get("/", [](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/", instrumented("/", [](const httplib::Request& req, httplib::Response& res) {
         std::string content = readFile(webDir + "/index.html");
         if (content.empty()) {
             res.status = 404;
@@ -585,10 +1429,10 @@ int main(int argc, char* argv[]) {
             return;
         }
         res.set_content(content, "text/html");
-    });
+    }));
 
     // API: Whoami
-    svr.Get("/api/whoami", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "GET", "/whoami", "", [](const httplib::Request& req, httplib::Response& res) {
         loadSession();
         json j;
         if (isAuthenticated) {
@@ -600,7 +1444,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Auth login
-    svr.Post("/api/auth/login", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/auth/login", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::string user = j.value("username", "");
@@ -622,7 +1466,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Auth register
-    svr.Post("/api/auth/register", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/auth/register", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::string user = j.value("username", "");
@@ -649,14 +1493,14 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Auth logout
-    svr.Post("/api/auth/logout", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/auth/logout", "", [](const httplib::Request& req, httplib::Response& res) {
         logoutUser();
         json r = {{"ok", true}};
         res.set_content(r.dump(), "application/json");
     });
 
     // API: Init repo
-    svr.Post("/api/init", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/init", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::string name = j.value("name", "");
@@ -667,6 +1511,7 @@ int main(int argc, char* argv[]) {
                 return;
             }
             initRepository(name, j.value("local", false));
+            publishChanges();
             json r = {{"ok", true}};
             res.set_content(r.dump(), "application/json");
         } catch (std::exception& e) {
@@ -677,7 +1522,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Status
-    svr.Get("/api/status", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "GET", "/status", "", [](const httplib::Request& req, httplib::Response& res) {
         loadRepositoryPath();
         if (repositoryPath.empty()) {
             json r = {{"error", "Repository not initialized. Run 'init' first."}};
@@ -685,20 +1530,17 @@ int main(int argc, char* argv[]) {
             res.set_content(r.dump(), "application/json");
             return;
         }
-        json r;
-        r["staged"] = getStagedFiles();
-        // Get current branch
-        r["branch"] = getCurrentBranch();
-        // Get staged file details
-        json stagedInfo = json::array();
-        for (const auto& f : getStagedFiles()) {
-            stagedInfo.push_back(f);
-        }
-        res.set_content(r.dump(), "application/json");
+        std::vector<std::string> staged = getStagedFiles();
+        std::string branch = getCurrentBranch();
+        streamJson(res, [staged, branch](JsonWriter& w) {
+            w.beginObject().key("branch").string(branch).key("staged").beginArray();
+            for (const auto& f : staged) w.string(f);
+            w.endArray().endObject();
+        });
     });
 
     // API: Add
-    svr.Post("/api/add", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/add", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::vector<std::string> files = j.value("files", std::vector<std::string>());
@@ -708,7 +1550,11 @@ int main(int argc, char* argv[]) {
                 res.set_content(r.dump(), "application/json");
                 return;
             }
-            addToStaging(files);
+            {
+                auto write = writeLock();
+                addToStaging(files);
+            }
+            publishChanges();
             json r = {{"ok", true}};
             res.set_content(r.dump(), "application/json");
         } catch (...) {
@@ -719,11 +1565,15 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Reset
-    svr.Post("/api/reset", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/reset", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::vector<std::string> files = j.value("files", std::vector<std::string>());
-            resetStaging(files);
+            {
+                auto write = writeLock();
+                resetStaging(files);
+            }
+            publishChanges();
             json r = {{"ok", true}};
             res.set_content(r.dump(), "application/json");
         } catch (...) {
@@ -734,7 +1584,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Commit
-    svr.Post("/api/commit", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/commit", "", [](const httplib::Request& req, httplib::Response& res) {
         loadSession();
         if (!isAuthenticated) {
             json r = {{"ok", false}, {"error", "Authentication required"}};
@@ -752,8 +1602,16 @@ int main(int argc, char* argv[]) {
                 res.set_content(r.dump(), "application/json");
                 return;
             }
-            commitFiles(files, message);
-            json r = {{"ok", true}};
+            if (!activeRepo) {
+                json r = {{"ok", false}, {"error", "Repository not initialized"}};
+                res.status = 400;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+            auto job = commitExecutor->submit(activeRepo, message, files);
+            json r = {{"ok", true}, {"job", job->id}};
+            res.status = 202;
+            res.set_header("Location", req.path.substr(0, req.path.rfind("/commit")) + "/jobs/" + job->id);
             res.set_content(r.dump(), "application/json");
         } catch (...) {
             json r = {{"ok", false}, {"error", "Bad request"}};
@@ -762,8 +1620,209 @@ int main(int argc, char* argv[]) {
         }
     });
 
+    // API: Commit job status
+    apiRoute(svr, "GET", R"(/jobs/(\d+))", "/api/jobs/:id", [](const httplib::Request& req, httplib::Response& res) {
+        auto job = commitExecutor->find(routeParam(req, 0));
+        if (!job) {
+            json r = {{"error", "Unknown job"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        res.set_content(commitExecutor->describe(*job).dump(), "application/json");
+    });
+
+    // API: Download a file as of a commit (ID or unambiguous prefix): any file in its snapshot
+    apiRoute(svr, "GET", R"(/blob/([0-9a-f]{7,64})/(.+))", "/api/blob/:commit/:path", [](const httplib::Request& req, httplib::Response& res) {
+        codekeeper::Repository::TreeEntry blob;
+        std::string file = routeParam(req, 1);
+        if (!activeRepo || !activeRepo->engine->fileAt(activeRepo->engine->resolveCommit(routeParam(req, 0)), file, blob)) {
+            json r = {{"error", "No such file in commit"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        serveBlob(req, res, file, blob);
+    });
+
+    // API: Download a stored version by content hash
+    apiRoute(svr, "GET", R"(/blob/([0-9a-f]{64}))", "/api/blob/:hash", [](const httplib::Request& req, httplib::Response& res) {
+        std::string file;
+        codekeeper::Repository::TreeEntry blob;
+        if (!activeRepo || !activeRepo->engine->versionWithHash(routeParam(req, 0), file, blob)) {
+            json r = {{"error", "Unknown content hash"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        serveBlob(req, res, file, blob);
+    });
+
+    // API: Run several operations in order under one repository lock
+    apiRoute(svr, "POST", "/batch", "", [](const httplib::Request& req, httplib::Response& res) {
+        json ops;
+        bool stopOnError = true;
+        try {
+            auto j = json::parse(req.body);
+            ops = j.at("ops");
+            stopOnError = j.value("stopOnError", true);
+            if (!ops.is_array()) throw std::runtime_error("ops must be an array");
+        } catch (...) {
+            json r = {{"ok", false}, {"error", "Bad request"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        loadSession();
+        if (!activeRepo || repositoryPath.empty()) {
+            json r = {{"ok", false}, {"error", "Repository not initialized"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        json results = json::array();
+        bool ok = true;
+        {
+            std::lock_guard<std::mutex> write(activeRepo->writeMutex);
+            sessionPinned = true;
+            for (const auto& op : ops) {
+                std::string name = op.is_object() ? op.value("op", "") : "";
+                if (!ok && stopOnError) {
+                    results.push_back({{"op", name}, {"ok", false}, {"skipped", true}});
+                    continue;
+                }
+                try {
+                    results.push_back(runBatchOp(op));
+                } catch (std::exception& e) {
+                    results.push_back({{"op", name}, {"ok", false}, {"error", e.what()}});
+                    ok = false;
+                }
+            }
+            sessionPinned = false;
+        }
+        // One round of events for the whole batch
+        publishChanges();
+        json r = {{"ok", ok}, {"results", results}};
+        res.set_content(r.dump(), "application/json");
+    });
+
+    // API: Start a resumable upload
+    apiRoute(svr, "POST", "/uploads", "", [](const httplib::Request& req, httplib::Response& res) {
+        loadSession();
+        if (!isAuthenticated) {
+            json r = {{"ok", false}, {"error", "Authentication required"}};
+            res.status = 401;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        try {
+            auto j = json::parse(req.body);
+            std::string path = j.value("path", "");
+            uint64_t size = j.value("size", uint64_t(0));
+            loadRepositoryPath();
+            if (!activeRepo || repositoryPath.empty()) {
+                json r = {{"ok", false}, {"error", "Repository not initialized"}};
+                res.status = 400;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+            if (path.empty() || fs::path(path).is_absolute() || !activeRepo->engine->contains((fs::path(repositoryPath) / path).string())) {
+                json r = {{"ok", false}, {"error", "Invalid path"}};
+                res.status = 400;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+            auto up = uploadStore.create(activeRepo->path, path, size);
+            std::lock_guard<std::mutex> lock(up->mutex);
+            if (size == 0) {
+                auto write = writeLock();
+                finishUpload(*up);
+                publishChanges();
+            }
+            json r = UploadStore::describe(*up);
+            r["ok"] = true;
+            res.status = 201;
+            res.set_header("Location", req.path + "/" + up->id);
+            res.set_content(r.dump(), "application/json");
+        } catch (...) {
+            json r = {{"ok", false}, {"error", "Bad request"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+        }
+    });
+
+    // API: Upload status (offset to resume from)
+    apiRoute(svr, "GET", R"(/uploads/([0-9a-f]{32}))", "/api/uploads/:id", [](const httplib::Request& req, httplib::Response& res) {
+        auto up = activeRepo ? uploadStore.find(activeRepo->path, routeParam(req, 0)) : nullptr;
+        if (!up) {
+            json r = {{"error", "Unknown upload"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(up->mutex);
+        res.set_content(UploadStore::describe(*up).dump(), "application/json");
+    });
+
+    // API: Send upload bytes starting at ?offset=N
+    apiRoute(svr, R"(/uploads/([0-9a-f]{32}))", "/api/uploads/:id", [](const httplib::Request& req, httplib::Response& res,
+                                                                       const httplib::ContentReader& reader) {
+        loadSession();
+        if (!isAuthenticated) {
+            json r = {{"ok", false}, {"error", "Authentication required"}};
+            res.status = 401;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        auto up = activeRepo ? uploadStore.find(activeRepo->path, routeParam(req, 0)) : nullptr;
+        if (!up) {
+            json r = {{"ok", false}, {"error", "Unknown upload"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(up->mutex);
+        uint64_t offset = 0;
+        try {
+            offset = req.has_param("offset") ? std::stoull(req.get_param_value("offset")) : up->offset;
+        } catch (...) {
+            offset = UINT64_MAX;
+        }
+        if (up->done || offset != up->offset) {
+            json r = UploadStore::describe(*up);
+            r["ok"] = false;
+            r["error"] = "Offset mismatch";
+            res.status = 409;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        if (!appendUpload(*up, reader)) {
+            json r = UploadStore::describe(*up);
+            r["ok"] = false;
+            r["error"] = "Upload interrupted or larger than declared size";
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        if (up->offset == up->size) {
+            try {
+                auto write = writeLock();
+                finishUpload(*up);
+            } catch (std::exception& e) {
+                json r = {{"ok", false}, {"error", e.what()}};
+                res.status = 500;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+            publishChanges();
+        }
+        json r = UploadStore::describe(*up);
+        r["ok"] = true;
+        res.set_content(r.dump(), "application/json");
+    });
+
     // API: History
-    svr.Get("/api/history", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "GET", "/history", "", [](const httplib::Request& req, httplib::Response& res) {
         loadRepositoryPath();
         if (repositoryPath.empty()) {
             json r = {{"error", "Repository not initialized"}};
@@ -771,13 +1830,95 @@ int main(int argc, char* argv[]) {
             res.set_content(r.dump(), "application/json");
             return;
         }
+        streamHistory(res, activeRepo);
+    });
+
+    // API: Unified diff of what commit `a` changed, or between commits `a` and `b`; streamed file by file
+    apiRoute(svr, "GET", "/diff", "", [](const httplib::Request& req, httplib::Response& res) {
+        auto repo = openRepository();
+        if (!repo) {
+            json r = {{"error", "Repository not initialized"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        std::string a = req.has_param("a") ? req.get_param_value("a") : "";
+        std::string b = req.has_param("b") ? req.get_param_value("b") : "";
+        std::string to = repo->resolveCommit(b.empty() ? a : b);
+        std::string from = b.empty() ? repo->parentOf(to) : repo->resolveCommit(a);
+        if (to.empty() || (!b.empty() && from.empty())) {
+            json r = {{"error", "Unknown or ambiguous commit"}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        auto changes = std::make_shared<std::vector<codekeeper::Repository::FileChange>>(
+            repo->changes(from, to, req.has_param("path") ? req.get_param_value("path") : ""));
+        auto next = std::make_shared<size_t>(0);
+        res.set_chunked_content_provider("text/x-diff", [repo, changes, next](size_t, httplib::DataSink& sink) {
+            if (*next == changes->size()) {
+                sink.done();
+                return true;
+            }
+            std::string text = repo->diff((*changes)[(*next)++]);
+            return sink.write(text.data(), text.size());
+        });
+    });
+
+    // API: Files changed and lines added/removed per commit (ids=<id>,<id>,...; cached on disk)
+    apiRoute(svr, "GET", "/diffstats", "", [](const httplib::Request& req, httplib::Response& res) {
+        auto repo = openRepository();
+        std::vector<std::string> ids = split(req.has_param("ids") ? req.get_param_value("ids") : "", ',');
+        const size_t kMaxIds = 500;
+        if (!repo || ids.size() > kMaxIds) {
+            json r = {{"error", repo ? "At most 500 ids per request" : "Repository not initialized"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        json stats = json::object();
+        for (const auto& id : ids) {
+            std::string full = repo->resolveCommit(id);
+            if (full.empty()) continue;
+            codekeeper::Repository::DiffStat stat = repo->diffStat(full);
+            stats[id] = {{"files", stat.files}, {"added", stat.added}, {"removed", stat.removed}};
+        }
         json j;
-        j["commits"] = getHistory();
+        j["stats"] = stats;
         res.set_content(j.dump(), "application/json");
     });
 
+    // API: Commit that last changed each line of a file (path=, optional commit=)
+    apiRoute(svr, "GET", "/blame", "", [](const httplib::Request& req, httplib::Response& res) {
+        auto repo = openRepository();
+        std::string path = req.has_param("path") ? req.get_param_value("path") : "";
+        std::string commit = req.has_param("commit") ? req.get_param_value("commit") : "";
+        std::string at = commit.empty() || !repo ? "" : repo->resolveCommit(commit);
+        if (!repo || path.empty() || (!commit.empty() && at.empty())) {
+            json r = {{"error", !repo ? "Repository not initialized" : path.empty() ? "path is required" : "Unknown or ambiguous commit"}};
+            res.status = repo && !path.empty() ? 404 : 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        auto blame = std::make_shared<codekeeper::Repository::Blame>();
+        try {
+            *blame = repo->blame(path, at);
+        } catch (const std::exception& e) {
+            json r = {{"error", e.what()}};
+            res.status = 404;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        streamJson(res, [blame](JsonWriter& w) {
+            w.beginObject().key("path").string(blame->path).key("commit").string(blame->commit);
+            w.key("lines").beginArray();
+            for (const auto& line : blame->lines) w.beginObject().key("commit").string(line.commit).key("text").string(line.text).endObject();
+            w.endArray().endObject();
+        });
+    });
+
     // API: Rollback
-    svr.Post("/api/rollback", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/rollback", "", [](const httplib::Request& req, httplib::Response& res) {
         loadSession();
         if (!isAuthenticated) {
             json r = {{"ok", false}, {"error", "Authentication required"}};
@@ -795,7 +1936,15 @@ int main(int argc, char* argv[]) {
                 res.set_content(r.dump(), "application/json");
                 return;
             }
-            rollback(target, guid);
+            try {
+                auto write = writeLock();
+                rollback(target, guid);
+            } catch (std::exception& e) {
+                json r = {{"ok", false}, {"error", e.what()}};
+                res.status = 404;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
             json r = {{"ok", true}};
             res.set_content(r.dump(), "application/json");
         } catch (...) {
@@ -805,8 +1954,57 @@ int main(int argc, char* argv[]) {
         }
     });
 
+    // API: Restore the working tree to a commit (commit=<id or prefix>, force=true to overwrite
+    // uncommitted changes)
+    apiRoute(svr, "POST", "/checkout", "", [](const httplib::Request& req, httplib::Response& res) {
+        loadSession();
+        if (!isAuthenticated) {
+            json r = {{"ok", false}, {"error", "Authentication required"}};
+            res.status = 401;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        auto repo = openRepository();
+        std::string id;
+        bool force = false;
+        try {
+            auto j = json::parse(req.body);
+            id = repo ? repo->resolveCommit(j.value("commit", "")) : "";
+            force = j.value("force", false);
+        } catch (...) {
+            json r = {{"ok", false}, {"error", "Bad request"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        if (id.empty()) {
+            json r = {{"ok", false}, {"error", repo ? "Unknown or ambiguous commit" : "Repository not initialized"}};
+            res.status = repo ? 404 : 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        codekeeper::Repository::Checkout checkout;
+        {
+            auto write = writeLock();
+            try {
+                checkout = repo->checkout(id, force);
+            } catch (const std::exception& e) {
+                // Uncommitted changes in the way
+                json r = {{"ok", false}, {"error", e.what()}};
+                res.status = 409;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+        }
+        publishChanges();
+        json r = {{"ok", checkout.failed.empty() && checkout.mismatched.empty()}, {"commit", checkout.commit},
+                  {"written", checkout.written}, {"removed", checkout.removed}, {"skipped", checkout.skipped},
+                  {"failed", checkout.failed}, {"mismatched", checkout.mismatched}};
+        res.set_content(r.dump(), "application/json");
+    });
+
     // API: Branches
-    svr.Get("/api/branches", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "GET", "/branches", "", [](const httplib::Request& req, httplib::Response& res) {
         loadRepositoryPath();
         json j;
         if (!repositoryPath.empty()) {
@@ -820,7 +2018,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Create branch
-    svr.Post("/api/branch", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/branch", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::string name = j.value("name", "");
@@ -829,7 +2027,11 @@ int main(int argc, char* argv[]) {
                 res.status = 400;
                 res.set_content(r.dump(), "application/json"); return;
             }
-            createBranch(name);
+            {
+                auto write = writeLock();
+                createBranch(name);
+            }
+            publishChanges();
             json r = {{"ok", true}};
             res.set_content(r.dump(), "application/json");
         } catch (...) {
@@ -840,7 +2042,7 @@ int main(int argc, char* argv[]) {
     });
 
     // API: Switch branch
-    svr.Post("/api/switch", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "POST", "/switch", "", [](const httplib::Request& req, httplib::Response& res) {
         try {
             auto j = json::parse(req.body);
             std::string name = j.value("branch", "");
@@ -849,8 +2051,21 @@ int main(int argc, char* argv[]) {
                 res.status = 400;
                 res.set_content(r.dump(), "application/json"); return;
             }
-            switchBranch(name);
-            json r = {{"ok", true}};
+            codekeeper::Repository::Checkout checkout;
+            try {
+                auto write = writeLock();
+                checkout = switchBranch(name);
+            } catch (std::exception& e) {
+                auto branches = getBranches();
+                bool exists = name == getCurrentBranch() || std::find(branches.begin(), branches.end(), name) != branches.end();
+                json r = {{"ok", false}, {"error", e.what()}};
+                res.status = exists ? 409 : 404;
+                res.set_content(r.dump(), "application/json");
+                return;
+            }
+            publishChanges();
+            json r = {{"ok", true}, {"commit", checkout.commit}, {"written", checkout.written},
+                      {"removed", checkout.removed}, {"skipped", checkout.skipped}};
             res.set_content(r.dump(), "application/json");
         } catch (...) {
             json r = {{"ok", false}, {"error", "Bad request"}};
@@ -860,24 +2075,88 @@ int main(int argc, char* argv[]) {
     });
 
     // API: List conflicts
-    svr.Get("/api/list-conflicts", [](const httplib::Request& req, httplib::Response& res) {
+    apiRoute(svr, "GET", "/list-conflicts", "", [](const httplib::Request& req, httplib::Response& res) {
         loadRepositoryPath();
-        json j;
-        if (!repositoryPath.empty()) {
-            j["conflicts"] = listConflicts();
-        } else {
-            j["conflicts"] = json::array();
+        std::vector<std::string> conflicts;
+        if (!repositoryPath.empty()) conflicts = listConflicts();
+        streamJson(res, [conflicts](JsonWriter& w) {
+            w.beginObject().key("conflicts").beginArray();
+            for (const auto& f : conflicts) w.string(f);
+            w.endArray().endObject();
+        });
+    });
+
+    // API: Live repository events (Server-Sent Events)
+    apiRoute(svr, "GET", "/events", "", [](const httplib::Request& req, httplib::Response& res) {
+        if (!activeRepo) {
+            json r = {{"error", "Repository not initialized"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
         }
+        // The stream keeps the handle alive (and out of eviction) while it is open
+        std::shared_ptr<RepoHandle> repo = activeRepo;
+        uint64_t since = repo->events.latestSeq();
+        if (req.has_header("Last-Event-ID")) {
+            try { since = std::stoull(req.get_header_value("Last-Event-ID")); } catch (...) {}
+        }
+        res.set_header("Cache-Control", "no-cache");
+        res.set_header("X-Accel-Buffering", "no");
+        res.set_chunked_content_provider("text/event-stream", [repo, since](size_t, httplib::DataSink& sink) mutable {
+            bool lost = false;
+            auto events = repo->events.waitFor(since, std::chrono::seconds(15), lost);
+            std::string out;
+            if (lost) out += "event: resync\ndata: {}\n\n";
+            for (const auto& e : events) {
+                out += "id: " + std::to_string(e.seq) + "\nevent: " + e.type + "\ndata: " + e.data + "\n\n";
+                since = e.seq;
+            }
+            // Comment line keeps proxies from closing an idle stream
+            if (out.empty()) out = ": keep-alive\n\n";
+            return sink.write(out.data(), out.size());
+        });
+    });
+
+    // API: Repositories under the central directory, with summary stats on request
+    svr.Get("/api/repos", instrumented("/api/repos", [](const httplib::Request& req, httplib::Response& res) {
+        bool withStats = req.has_param("stats");
+        json repos = json::array();
+        for (const auto& name : repoRegistry.list()) {
+            if (!withStats) { repos.push_back({{"name", name}}); continue; }
+            try {
+                repos.push_back(repoRegistry.open(name)->summary());
+            } catch (std::exception& e) {
+                repos.push_back({{"name", name}, {"error", e.what()}});
+            }
+        }
+        json j;
+        j["repos"] = repos;
         res.set_content(j.dump(), "application/json");
+    }));
+
+    // API: Summary stats for one repository
+    apiRoute(svr, "GET", "/summary", "", [](const httplib::Request& req, httplib::Response& res) {
+        if (!activeRepo) {
+            json r = {{"error", "Repository not initialized"}};
+            res.status = 400;
+            res.set_content(r.dump(), "application/json");
+            return;
+        }
+        res.set_content(activeRepo->summary().dump(), "application/json");
+    });
+
+    // Prometheus scrape endpoint
+    svr.Get("/metrics", [](const httplib::Request& req, httplib::Response& res) {
+        res.set_content(metrics.render(), "text/plain; version=0.0.4");
     });
 
     // API: Whoami (alias)
-    svr.Options(".*", [](const httplib::Request& req, httplib::Response& res) {
+    svr.Options(".*", instrumented("OPTIONS", [](const httplib::Request& req, httplib::Response& res) {
         res.status = 200;
-    });
+    }));
 
     // Serve static files from web directory
-    svr.Get("/(.*)", [](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/(.*)", instrumented("static", [](const httplib::Request& req, httplib::Response& res) {
         std::string path = webDir + "/" + req.matches[1].str();
         // Security: prevent directory traversal
         fs::path resolved = fs::weakly_canonical(path);
@@ -910,12 +2189,22 @@ int main(int argc, char* argv[]) {
 
         std::string content = readFile(resolved.string());
         res.set_content(content, mime);
-    });
+    }));
 
-    if (!svr.listen("0.0.0.0", port)) {
+    bool listened = svr.listen("0.0.0.0", port);
+    codekeeper::trace::stop();
+    if (!listened) {
         std::cerr << "Error: Could not start server on port " << port << std::endl;
         std::cerr << "Try a different port: codekeeper-web <port>" << std::endl;
         return 1;
     }
     return 0;
 }
+
+}  // namespace codekeeper_web
+
+#ifndef CODEKEEPER_WITH_WEB
+int main(int argc, char* argv[]) {
+    return codekeeper_web::runServer(argc, argv);
+}
+#endif
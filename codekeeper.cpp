@@ -15,10 +15,26 @@
 #include <set>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <map>
+#include <csignal>
+#include <chrono>
+#include <thread>
+#include <sys/resource.h>
 
 #include <sys/stat.h>
+#include "libcodekeeper.h"
 namespace fs = std::filesystem;
 
+#ifdef CODEKEEPER_WITH_WEB
+// Web server linked in from codekeeper-web.cpp; `serve` runs it in this process
+namespace codekeeper_web { int runServer(int argc, char* argv[]); }
+#endif
+using codekeeper::split;
+using codekeeper::collectFiles;
+
 // Structure to hold metadata for commits
 struct Commit {
     std::string message;
@@ -29,112 +45,6 @@ struct Commit {
 
 std::string repositoryPath;
 
-// Function to generate a timestamp
-std::string getTimestamp() {
-    std::time_t now = std::time(nullptr);
-    char buf[80];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
-    return buf;
-}
-
-// utility function
-std::vector<std::string> split(const std::string &str, char delimiter)
-{
-    std::vector<std::string> tokens;
-    std::stringstream ss(str);
-    std::string token;
-    while (std::getline(ss, token, delimiter))
-    {
-        tokens.push_back(token);
-    }
-    return tokens;
-}
-
-// Ensure a file path is within the repository (prevents path traversal)
-bool isPathSafe(const std::string& filePath) {
-    try {
-        fs::path resolved = fs::weakly_canonical(fs::absolute(filePath));
-        fs::path repo = fs::weakly_canonical(fs::absolute(repositoryPath));
-        auto rel = fs::relative(resolved, repo);
-        return !rel.empty() && rel.string().find("..") == std::string::npos;
-    } catch (...) {
-        return false;
-    }
-}
-
-bool filesAreEqual(const std::string &filePath1, const std::string &filePath2)
-{
-    std::ifstream file1(filePath1, std::ios::binary);
-    std::ifstream file2(filePath2, std::ios::binary);
-    return std::equal(std::istreambuf_iterator<char>(file1), std::istreambuf_iterator<char>(),
-                      std::istreambuf_iterator<char>(file2));
-}
-
-// Escape special characters for log safety
-std::string escape(const std::string& input) {
-    std::string output;
-    for (char c : input) {
-        if (c == '|') output += "\\|";
-        else output += c;
-    }
-    return output;
-}
-// Helper function to compute SHA-256 hash of a string
-std::string computeStringHash(const std::string& input) {
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) return "";
-
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int length = 0;
-
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1 ||
-        EVP_DigestUpdate(ctx, input.c_str(), input.size()) != 1 ||
-        EVP_DigestFinal_ex(ctx, hash, &length) != 1) {
-        EVP_MD_CTX_free(ctx);
-        return "";
-    }
-
-    EVP_MD_CTX_free(ctx);
-
-    std::ostringstream result;
-    for (unsigned int i = 0; i < length; ++i) {
-        result << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    }
-
-    return result.str();
-}
-/// Function to compute SHA-256 hash of a file (simple implementation)
-std::string computeFileHash(const fs::path& filePath) 
-{
-        std::ifstream file(filePath, std::ios::binary);
-    if (!file) return "";
-
-    EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-    if (!mdctx) return "";
-
-    const EVP_MD* md = EVP_sha256();
-    if (1 != EVP_DigestInit_ex(mdctx, md, nullptr)) { EVP_MD_CTX_free(mdctx); return ""; }
-
-    char buffer[8192];
-    while (file.good()) {
-        file.read(buffer, sizeof(buffer));
-        if (1 != EVP_DigestUpdate(mdctx, buffer, file.gcount())) { EVP_MD_CTX_free(mdctx); return ""; }
-    }
-
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen = 0;
-    if (1 != EVP_DigestFinal_ex(mdctx, hash, &hashLen)) { EVP_MD_CTX_free(mdctx); return ""; }
-
-    EVP_MD_CTX_free(mdctx);
-
-    std::ostringstream result;
-    for (unsigned int i = 0; i < hashLen; ++i) {
-        result << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-
-    return result.str();
-}
-
 //function to get current repo path
 std::string getCentralRepositoryPath()
 {
@@ -220,344 +130,99 @@ void initRepository(const std::string& projectName, bool local = false)
         std::cout << "Change your terminal to the project folder: cd " << repositoryPath << "\n";
     }
 }
-// Run a hook script if it exists; return true if success, false if failed
-bool runHook(const std::string& hookName) {
-    fs::path hookPath = fs::path(repositoryPath) / hookName;
-    if (fs::exists(hookPath) && fs::is_regular_file(hookPath)) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            execlp("/bin/bash", "bash", hookPath.c_str(), nullptr);
-            _exit(127);
-        } else if (pid > 0) {
-            int status;
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                return true;
-            }
-            std::cerr << hookName << " hook failed (exit code " << WEXITSTATUS(status) << ").\n";
-            return false;
-        }
-    }
-    return true;
-}
-
-// Recursively collect regular files from a path (skips hidden, repo, and binary files)
-std::vector<std::string> collectFiles(const std::string& path) {
-    std::vector<std::string> files;
-    fs::path p = fs::absolute(path);
-    if (!fs::exists(p)) return files;
-    if (fs::is_regular_file(p)) {
-        files.push_back(p.string());
-    } else if (fs::is_directory(p)) {
-        for (const auto& entry : fs::recursive_directory_iterator(p)) {
-            if (fs::is_regular_file(entry)) {
-                std::string fname = entry.path().filename().string();
-                // Skip hidden files, repo internals, and the binary
-                if (fname[0] == '.' || fname == "commit_log.txt" || fname == "codekeeper" || fname == "codekeeper.exe") continue;
-                // Skip files inside repo-internal directories (.staging, versions, branches)
-                auto rel = fs::relative(entry.path(), p);
-                bool inInternal = false;
-                for (const auto& part : rel) {
-                    std::string s = part.string();
-                    if (s == ".staging" || s == "versions" || s == "branches" || s[0] == '.') { inInternal = true; break; }
-                }
-                if (!inInternal) files.push_back(fs::absolute(entry.path()).string());
-            }
-        }
-    }
-    return files;
+// Engine for the repository named in .repo_path; null (after an error message) when uninitialized
+std::shared_ptr<codekeeper::Repository> openRepository() {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) return nullptr;
+    return codekeeper::Repository::open(repositoryPath);
 }
 
 // Function to add files to staging area
 void addToStaging(const std::vector<std::string>& filePaths) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) {
-        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
-        return;
-    }
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    if (!fs::exists(stagingDir)) {
-        fs::create_directory(stagingDir);
-    }
-    for (const auto& filePath : filePaths) {
-        auto expanded = collectFiles(filePath);
-        for (const auto& src : expanded) {
-            if (!isPathSafe(src)) {
-                std::cerr << "Error: File " << src << " is outside the repository.\n";
-                continue;
-            }
-            fs::path dest = stagingDir / fs::path(src).filename();
-            fs::copy(src, dest, fs::copy_options::overwrite_existing);
-            std::cout << "Staged: " << src << "\n";
-        }
-    }
+    auto repo = openRepository();
+    if (!repo) return;
+    auto result = repo->stage(filePaths);
+    for (const auto& src : result.rejected) std::cerr << "Error: File " << src << " is outside the repository.\n";
+    for (const auto& src : result.staged) std::cout << "Staged: " << src << "\n";
 }
 
 // Function to reset (unstage) files from staging area
 void resetStaging(const std::vector<std::string>& filePaths) {
-    loadRepositoryPath();
-    if (repositoryPath.empty()) {
-        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
-        return;
-    }
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
+    auto repo = openRepository();
+    if (!repo) return;
+    auto removed = repo->unstage(filePaths);
     for (const auto& filePath : filePaths) {
-        fs::path stagedFile = stagingDir / fs::path(filePath).filename();
-        if (fs::exists(stagedFile)) {
-            fs::remove(stagedFile);
+        if (std::find(removed.begin(), removed.end(), filePath) != removed.end())
             std::cout << "Unstaged: " << filePath << "\n";
-        } else {
+        else
             std::cout << "File not staged: " << filePath << "\n";
-        }
     }
 }
 
 // Helper to get all staged files
 std::vector<std::string> getStagedFiles() {
-    loadRepositoryPath();
-    std::vector<std::string> stagedFiles;
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    if (fs::exists(stagingDir)) {
-        for (const auto& entry : fs::directory_iterator(stagingDir)) {
-            if (fs::is_regular_file(entry)) {
-                stagedFiles.push_back(entry.path().string());
-            }
-        }
-    }
-    return stagedFiles;
+    auto repo = openRepository();
+    return repo ? repo->stagedFiles() : std::vector<std::string>();
 }
 
 // Function to commit multiple files
-void commitFiles(const std::vector<std::string>& filePaths, const std::string& commitMessage) 
+void commitFiles(const std::vector<std::string>& filePaths, const std::string& commitMessage)
 {
-    loadRepositoryPath();
-    fs::path repoPath = fs::weakly_canonical(repositoryPath);
-    fs::path versionDir = repoPath / "versions";
-
-    if (repositoryPath.empty() || !fs::exists(versionDir)) {
-        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
-        return;
-    }
-
-    // Run pre-commit hook
-    if (!runHook(".pre-commit")) {
-        std::cerr << "Commit aborted by pre-commit hook.\n";
-        return;
-    }
-
-    // If no files specified but staging exists and has files, use staged files
-    std::vector<std::string> filesToCommit = filePaths;
-    fs::path stagingDir = repoPath / ".staging";
-    if (fs::exists(stagingDir)) {
-        std::vector<std::string> staged = getStagedFiles();
-        if (!staged.empty() && filesToCommit.empty()) {
-            filesToCommit = staged;
-        }
-    }
-
-    if (filesToCommit.empty()) {
+    auto repo = openRepository();
+    if (!repo) return;
+    if (filePaths.empty() && repo->stagedFiles().empty()) {
         std::cerr << "Error: No files specified and no files in staging.\n";
         std::cerr << "Usage: codekeeper commit <message> <file1> [file2 ...] or stage files first.\n";
         return;
     }
-
-    std::ifstream bypassFile(repoPath / ".bypass");
-    std::vector<std::string> ignoredFiles;
-    std::string line;
-    while (std::getline(bypassFile, line)) {
-        if (!line.empty() && line[0] != '#') {
-            ignoredFiles.push_back(line);
-        }
-    }
-
-    std::vector<std::string> versionPaths;
-    std::vector<std::string> fileHashes;
-    // Expand directories to individual files
-    std::vector<std::string> expandedFiles;
-    for (const auto& fp : filesToCommit) {
-        auto collected = collectFiles(fp);
-        expandedFiles.insert(expandedFiles.end(), collected.begin(), collected.end());
-    }
-    for (const auto& filePath : expandedFiles) {
-        if (!isPathSafe(filePath)) {
-            std::cerr << "Error: File " << filePath << " is outside the repository.\n";
-            continue;
-        }
-        fs::path file = fs::absolute(filePath);
-
-        if (!fs::exists(file)) {
-            std::cerr << "Error: File " << file << " does not exist.\n";
-            continue;
-        }
-
-        if (std::find(ignoredFiles.begin(), ignoredFiles.end(), filePath) != ignoredFiles.end()) {
-            std::cout << "Skipping ignored file: " << filePath << "\n";
-            continue;
-        }
-
-        std::string versionFile = "version_" + std::to_string(std::time(nullptr)) + "_" + file.filename().string();
-        fs::path versionFilePath = versionDir / versionFile;
-
-        fs::copy(file, versionFilePath, fs::copy_options::overwrite_existing);
-        versionPaths.push_back(versionFilePath.string());
-        fileHashes.push_back(computeFileHash(file));
-    }
-
-    std::string timestamp = getTimestamp();
-
-    // Use expanded file list for commit, not original paths
-    filesToCommit = expandedFiles;
-
-    if (filesToCommit.empty()) {
-        std::cerr << "Error: No valid files to commit (all rejected or not found).\n";
+    codekeeper::Repository::CommitResult result;
+    try {
+        result = repo->commit(filePaths, commitMessage);
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << ".\n";
         return;
     }
-
-    // Prepare commit content for hashing (includes parent hash for chain integrity)
-    std::string parentHash;
-    {
-        std::ifstream logFile(repoPath / "commit_log.txt");
-        std::string lastLine;
-        while (std::getline(logFile, lastLine)) {}
-        if (!lastLine.empty()) {
-            parentHash = split(lastLine, '|')[0];
-        }
-    }
-    std::ostringstream commitContent;
-    commitContent << commitMessage << "|" << timestamp;
-    if (!parentHash.empty()) commitContent << "|parent=" << parentHash;
-    for (size_t i = 0; i < filesToCommit.size(); ++i) {
-        commitContent << "|" << fs::absolute(filesToCommit[i]).string() << "|" << fileHashes[i];
-    }
-    commitContent << "|";
-    for (const auto& versionPath : versionPaths) {
-        commitContent << versionPath << "|";
-    }
-    std::string commitID = computeStringHash(commitContent.str());
-
-    std::ofstream logFile(repoPath / "commit_log.txt", std::ios::app);
-    logFile << commitID << "|" << escape(commitMessage) << "|" << timestamp;
-    for (size_t i = 0; i < filesToCommit.size(); ++i) {
-        logFile << "|" << escape(fs::absolute(filesToCommit[i]).string())
-                << "|" << fileHashes[i];
-    }
-    logFile << "|";
-    for (const auto& versionPath : versionPaths) {
-        logFile << versionPath << "|";
-    }
-    logFile << "\n";
-    logFile.close();
+    for (const auto& f : result.rejected) std::cerr << "Error: File " << f << " is outside the repository.\n";
+    for (const auto& f : result.missing) std::cerr << "Error: File " << f << " does not exist.\n";
+    for (const auto& f : result.ignored) std::cout << "Skipping ignored file: " << f << "\n";
     std::cout << "Files committed successfully with message: " << commitMessage << "\n";
-
-    // Run post-commit hook
-    runHook(".post-commit");
-
-    // Clear staging area after commit
-    if (fs::exists(stagingDir)) {
-        for (const auto& entry : fs::directory_iterator(stagingDir)) {
-            fs::remove(entry);
-        }
-    }
 }
 
 // Function to retrieve files by commit message
 void retrieveFiles(const std::string& commitMessage) {
-    loadRepositoryPath();
-    fs::path repoPath = fs::weakly_canonical(repositoryPath);
-    fs::path logPath = repoPath / "commit_log.txt";
-
-    if (repositoryPath.empty() || !fs::exists(logPath)) {
+    auto repo = openRepository();
+    if (!repo) {
         std::cerr << "Error: Repository not initialized or log file missing.\n";
         return;
     }
-
-    std::ifstream logFile(logPath);
-    std::string line;
-
-    while (std::getline(logFile, line)) {
-        size_t pos1 = line.find('|');
-        size_t pos2 = line.find('|', pos1 + 1);
-        std::string message = line.substr(pos1 + 1, pos2 - pos1 - 1);
-
-        if (message == escape(commitMessage)) {
-            size_t pos3 = line.find('|', pos2 + 1);
-            size_t pos4 = line.find_last_of('|');
-            std::string fileData = line.substr(pos3 + 1, pos4 - pos3 - 1);
-            std::vector<std::string> tokens = split(fileData, '|');
-            std::vector<std::string> originalPaths, hashes;
-
-            for (size_t i = 0; i + 1 < tokens.size(); i += 2) {
-                originalPaths.push_back(tokens[i]);
-                hashes.push_back(tokens[i + 1]);
-            }
-
-            size_t half = tokens.size() / 2;
-            for (size_t i = 0; i < originalPaths.size(); ++i) {
-                fs::path dest = fs::current_path() / fs::path(originalPaths[i]).filename();
-                fs::copy(tokens[half + i * 2], dest, fs::copy_options::overwrite_existing);
-            }
-
-            std::cout << "Files retrieved successfully.\n";
-            return;
+    std::string id = repo->commitWithMessage(commitMessage);
+    if (id.empty()) {
+        std::cerr << "Error: Commit message not found.\n";
+        return;
+    }
+    try {
+        for (const auto& file : repo->committedFiles(id)) {
+            fs::path dest = fs::current_path() / fs::path(file.first).filename();
+            fs::copy(file.second.version, dest, fs::copy_options::overwrite_existing);
         }
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << ".\n";
+        return;
     }
-
-    std::cerr << "Error: Commit message not found.\n";
+    std::cout << "Files retrieved successfully.\n";
 }
 
 // Function for Rollback
 void rollback(const std::string &target, const std::string &commitGUID = "")
 {
-    std::string repopath = getCentralRepositoryPath();
-    if (repopath.empty())
-    {
-        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
-        return;
-    }
-
-    if (!isPathSafe(target)) {
-        std::cerr << "Error: Target " << target << " is outside the repository.\n";
-        return;
-    }
-
-    std::ifstream logFile(repopath + "/commit_log.txt");
-    if (!logFile.is_open())
-    {
-        std::cerr << "Error: Commit log file not found.\n";
-        return;
-    }
-
-    std::string line, foundVersionPath;
-    while (std::getline(logFile, line))
-    {
-        std::vector<std::string> tokens = split(line, '|');
-        if (tokens.size() < 5)
-            continue;
-
-        if ((!commitGUID.empty() && tokens[0] == commitGUID) ||
-            (commitGUID.empty() && std::find(tokens.begin() + 4, tokens.end(), target) != tokens.end()))
-        {
-            // Found matching commit or file
-            size_t versionIndex = 4 + (tokens.size() - 4) / 2;
-            for (size_t i = versionIndex; i < tokens.size(); ++i)
-            {
-                if (fs::path(tokens[i]).filename() == fs::path(target).filename())
-                {
-                    foundVersionPath = tokens[i];
-                    break;
-                }
-            }
-        }
-    }
-
-    if (foundVersionPath.empty())
-    {
-        std::cerr << "Error: No matching commit or version found for " << target << ".\n";
-        return;
+    auto repo = openRepository();
+    if (!repo) return;
+    try {
+        std::string version = repo->rollback(target, commitGUID);
+        std::cout << "Rolled back " << target << " to version: " << version << "\n";
+    } catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << ".\n";
     }
-
-    fs::copy(foundVersionPath, target, fs::copy_options::overwrite_existing);
-    std::cout << "Rolled back " << target << " to version: " << foundVersionPath << "\n";
 }
 
 // Function to check if the repository has been initialized
@@ -593,20 +258,11 @@ void createBranch(const std::string &branchName)
         }
     }
 
-    std::string branchesPath = repositoryPath + "/branches";
-    if (!fs::exists(branchesPath))
-    {
-        fs::create_directory(branchesPath);
-    }
-
-    std::string branchPath = branchesPath + "/" + branchName;
-    if (fs::exists(branchPath))
+    if (!codekeeper::Repository::open(repositoryPath)->createBranch(branchName))
     {
         std::cerr << "Error: Branch '" << branchName << "' already exists.\n";
         return;
     }
-
-    fs::create_directory(branchPath);
     std::cout << "Branch '" << branchName << "' created successfully.\n";
 }
 
@@ -618,24 +274,16 @@ void switchBranch(const std::string& branchName)
         std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
         return;
     }
-    std::string branchesPath = repositoryPath + "/branches";
-    std::string branchPath = branchesPath + "/" + branchName;
-    if (!fs::exists(branchPath) || !fs::is_directory(branchPath)) {
-        std::cerr << "Error: Branch '" << branchName << "' does not exist.\n";
+    codekeeper::Repository::Checkout checkout;
+    try {
+        checkout = codekeeper::Repository::open(repositoryPath)->switchBranch(branchName);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << ".\n";
         return;
     }
-    // Save current branch
-    std::ofstream currentBranchFile(repositoryPath + "/.current_branch");
-    currentBranchFile << branchName;
-    currentBranchFile.close();
-    // Copy all files from branch directory to working directory
-    for (const auto& entry : fs::directory_iterator(branchPath)) {
-        if (fs::is_regular_file(entry)) {
-            fs::path dest = fs::current_path() / entry.path().filename();
-            fs::copy(entry.path(), dest, fs::copy_options::overwrite_existing);
-        }
-    }
-    std::cout << "Switched to branch '" << branchName << "'.\n";
+    std::cout << "Switched to branch '" << branchName << "': " << checkout.written << " file(s) written, ";
+    if (checkout.removed > 0) std::cout << checkout.removed << " removed, ";
+    std::cout << checkout.skipped << " unchanged (skipped).\n";
 }
 
 // function to View History
@@ -655,12 +303,14 @@ void viewHistory()
         std::cerr << "Error: Commit log file not found.\n";
         return;
     }
+    codekeeper::stats::add(codekeeper::stats::FilesOpened);
 
     std::string line;
     while (std::getline(logFile, line))
     {
+        codekeeper::stats::add(codekeeper::stats::BytesRead, line.size() + 1);
 
-        // Commit format: GUID|Message|Timestamp|File1|File2|...|VersionPath1|VersionPath2|...
+        // Commit format: GUID|Message|Timestamp|File1|Hash1|...|VersionPath1|...|[parent=GUID|]
         std::vector<std::string> tokens = split(line, '|');
         if (tokens.size() < 5)
             continue; // Skip malformed entries
@@ -669,9 +319,10 @@ void viewHistory()
         std::cout << "Message: " << tokens[1] << "\n";
         std::cout << "Timestamp: " << tokens[2] << "\n";
         std::cout << "Files:\n";
-        for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; ++i)
+        size_t n = (tokens.size() - 3) / 3;
+        for (size_t i = 0; i < n; ++i)
         {
-            std::cout << "  - " << tokens[i] << "\n";
+            std::cout << "  - " << tokens[3 + 2 * i] << "\n";
         }
         std::cout << "------------------------\n";
     }
@@ -682,48 +333,19 @@ void viewHistory()
 // function for Conflict resolution
 bool checkConflicts(const std::string &filePath)
 {
-     loadRepositoryPath();
-
-    if (repositoryPath.empty())
+    auto repo = openRepository();
+    if (!repo)
     {
         std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
         return false;
     }
 
-    std::ifstream logFile(repositoryPath + "/commit_log.txt");
-    if (!logFile.is_open())
-    {
-        std::cerr << "Error: Commit log file not found.\n";
-        return false;
-    }
-
-    std::string latestVersion;
-    std::string line;
-    while (std::getline(logFile, line))
-    {
-        std::vector<std::string> tokens = split(line, '|');
-        if (std::find(tokens.begin() + 4, tokens.end(), filePath) != tokens.end())
-        {
-            size_t versionIndex = 4 + (tokens.size() - 4) / 2;
-            for (size_t i = versionIndex; i < tokens.size(); ++i)
-            {
-                if (fs::path(tokens[i]).filename() == fs::path(filePath).filename())
-                {
-                    latestVersion = tokens[i];
-                    break;
-                }
-            }
-        }
-    }
-
-    if (!latestVersion.empty() && fs::exists(filePath))
+    // Compare latest version with the current file
+    std::string latestVersion = repo->latestVersion(filePath);
+    if (!latestVersion.empty() && fs::exists(filePath) && !repo->sameContent(filePath, latestVersion))
     {
-        // Compare latest version with the current file
-        if (!filesAreEqual(filePath, latestVersion))
-        {
-            std::cerr << "Conflict detected in file: " << filePath << "\n";
-            return true;
-        }
+        std::cerr << "Conflict detected in file: " << filePath << "\n";
+        return true;
     }
 
     return false;
@@ -752,7 +374,7 @@ void archiveVersions()
         return;
     }
 
-    std::string archiveName = fs::path(repositoryPath).filename().string() + "_archive_" + getTimestamp() + ".zip";
+    std::string archiveName = fs::path(repositoryPath).filename().string() + "_archive_" + codekeeper::timestamp() + ".zip";
     fs::path archivePath = fs::path(repositoryPath) / archiveName;
 
     // Use fork+exec instead of system() for safety
@@ -771,82 +393,262 @@ void archiveVersions()
     }
 }
 
-// merging files
+// Whole file contents; false if it cannot be opened
+bool readWholeFile(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::ostringstream ss;
+    ss << file.rdbuf();
+    content = ss.str();
+    codekeeper::stats::add(codekeeper::stats::FilesOpened);
+    codekeeper::stats::add(codekeeper::stats::BytesRead, content.size());
+    return true;
+}
+
+// merging files: lines present on only one side are kept, lines changed on both sides
+// become conflict blocks
 void mergeFiles(const std::string &file1, const std::string &file2, const std::string &outputPath)
 {
-    std::ifstream input1(file1);
-    std::ifstream input2(file2);
-    std::ofstream output(outputPath);
-
-    if (!input1.is_open() || !input2.is_open() || !output.is_open())
+    std::string text1, text2;
+    if (!readWholeFile(file1, text1) || !readWholeFile(file2, text2))
     {
         std::cerr << "Error: Unable to open one or more files for merging.\n";
         return;
     }
+    codekeeper::MergeResult merged = codekeeper::mergeTwoWay(text1, text2, file1, file2);
 
-    std::string line1, line2;
-    while (std::getline(input1, line1) || std::getline(input2, line2))
+    std::ofstream output(outputPath, std::ios::binary);
+    if (!output.is_open())
     {
-        if (!line1.empty() && !line2.empty() && line1 != line2)
-        {
-            // Conflict: Append both lines with markers
-            output << "<<<<<<< " << file1 << "\n"
-                   << line1 << "\n=======\n"
-                   << line2 << "\n>>>>>>>\n";
-        }
-        else
-        {
-            // No conflict: Append whichever line is available
-            output << (!line1.empty() ? line1 : line2) << "\n";
-        }
-        line1.clear();
-        line2.clear();
+        std::cerr << "Error: Unable to open one or more files for merging.\n";
+        return;
     }
-
-    input1.close();
-    input2.close();
+    output << merged.text;
     output.close();
     std::cout << "Merge complete. Output written to: " << outputPath << "\n";
+    if (merged.conflicts > 0)
+        std::cout << merged.conflicts << " conflict(s) in " << outputPath << "\n";
 }
 
-// Interactive/manual merge for two files
+// Interactive/manual merge for two files, one prompt per block changed on both sides
 void interactiveMerge(const std::string& file1, const std::string& file2, const std::string& outputPath) {
-    std::ifstream input1(file1);
-    std::ifstream input2(file2);
-    std::ofstream output(outputPath);
-    if (!input1.is_open() || !input2.is_open() || !output.is_open()) {
+    std::string text1, text2;
+    std::ofstream output;
+    if (readWholeFile(file1, text1) && readWholeFile(file2, text2)) output.open(outputPath, std::ios::binary);
+    if (!output.is_open()) {
         std::cerr << "Error: Unable to open one or more files for merging.\n";
         return;
     }
-    std::string line1, line2;
-    while (true) {
-        bool has1 = static_cast<bool>(std::getline(input1, line1));
-        bool has2 = static_cast<bool>(std::getline(input2, line2));
-        if (!has1 && !has2) break;
-        if (has1 && has2 && line1 != line2) {
-            std::cout << "Conflict:\n1: " << line1 << "\n2: " << line2 << "\nChoose (1/2/e=edit): ";
-            std::string choice;
-            std::getline(std::cin, choice);
-            if (choice == "1") output << line1 << "\n";
-            else if (choice == "2") output << line2 << "\n";
-            else {
-                std::cout << "Edit> ";
-                std::string editLine;
-                std::getline(std::cin, editLine);
-                output << editLine << "\n";
-            }
-        } else if (has1) {
-            output << line1 << "\n";
-        } else if (has2) {
-            output << line2 << "\n";
+    auto lines1 = codekeeper::splitLines(text1);
+    auto lines2 = codekeeper::splitLines(text2);
+    auto write = [&](const std::vector<std::string_view>& lines, size_t start, size_t count) {
+        for (size_t i = start; i < start + count; ++i) {
+            output << lines[i];
+            if (lines[i].back() != '\n') output << "\n";
+        }
+    };
+    auto show = [](const char* label, const std::vector<std::string_view>& lines, size_t start, size_t count) {
+        for (size_t i = start; i < start + count; ++i) {
+            std::cout << label << lines[i];
+            if (lines[i].back() != '\n') std::cout << "\n";
+        }
+    };
+    size_t next = 0;
+    for (const auto& chunk : codekeeper::diffLines(lines1, lines2)) {
+        write(lines1, next, chunk.aStart - next);
+        next = chunk.aStart + chunk.aCount;
+        if (chunk.aCount == 0 || chunk.bCount == 0) {
+            write(lines1, chunk.aStart, chunk.aCount);
+            write(lines2, chunk.bStart, chunk.bCount);
+            continue;
+        }
+        std::cout << "Conflict at line " << chunk.aStart + 1 << ":\n";
+        show("1: ", lines1, chunk.aStart, chunk.aCount);
+        show("2: ", lines2, chunk.bStart, chunk.bCount);
+        std::cout << "Choose (1/2/b=both/e=edit): ";
+        std::string choice;
+        std::getline(std::cin, choice);
+        if (choice == "1") {
+            write(lines1, chunk.aStart, chunk.aCount);
+        } else if (choice == "2") {
+            write(lines2, chunk.bStart, chunk.bCount);
+        } else if (choice == "b") {
+            write(lines1, chunk.aStart, chunk.aCount);
+            write(lines2, chunk.bStart, chunk.bCount);
+        } else {
+            std::cout << "Edit (end with a line containing only '.'):\n";
+            std::string editLine;
+            while (std::getline(std::cin, editLine) && editLine != ".") output << editLine << "\n";
         }
     }
-    input1.close();
-    input2.close();
+    write(lines1, next, lines1.size() - next);
     output.close();
     std::cout << "Interactive merge complete. Output written to: " << outputPath << "\n";
 }
 
+// Unified diff of two files; returns 1 if they differ, 2 on error (as diff(1) does)
+int diffFiles(const std::string& file1, const std::string& file2) {
+    std::string text1, text2;
+    if (!readWholeFile(file1, text1) || !readWholeFile(file2, text2)) {
+        std::cerr << "Error: Unable to open one or more files to compare.\n";
+        return 2;
+    }
+    std::string diff = codekeeper::unifiedDiff(file1, text1, file2, text2);
+    std::cout << diff;
+    return diff.empty() ? 0 : 1;
+}
+
+// What a commit changed (one ID) or the difference between two commits, from the stored
+// versions; `path` limits it to a file or directory. Same exit codes as diffFiles.
+int diffCommits(const std::string& commitA, const std::string& commitB, const std::string& path) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) {
+        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
+        return 2;
+    }
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    std::string to = repo->resolveCommit(commitB.empty() ? commitA : commitB);
+    std::string from = commitB.empty() ? repo->parentOf(to) : repo->resolveCommit(commitA);
+    if (to.empty() || (!commitB.empty() && from.empty())) {
+        std::cerr << "Error: Unknown or ambiguous commit.\n";
+        return 2;
+    }
+    // A path on disk is matched as the absolute path the log records
+    std::string filter = path;
+    if (!filter.empty() && fs::exists(filter)) filter = fs::absolute(filter).lexically_normal().string();
+    std::vector<codekeeper::Repository::FileChange> changes = repo->changes(from, to, filter);
+    for (const auto& change : changes) std::cout << repo->diff(change) << std::flush;
+    return changes.empty() ? 0 : 1;
+}
+
+// Each line of a committed file with the commit that last changed it
+int blameFile(const std::string& path, const std::string& commit) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) {
+        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
+        return 1;
+    }
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    std::string at;
+    if (!commit.empty() && (at = repo->resolveCommit(commit)).empty()) {
+        std::cerr << "Error: Unknown or ambiguous commit.\n";
+        return 1;
+    }
+    // A path on disk is looked up as the absolute path the log records
+    std::string target = fs::exists(path) ? fs::absolute(path).lexically_normal().string() : path;
+    codekeeper::Repository::Blame blame;
+    try {
+        blame = repo->blame(target, at);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    size_t width = std::to_string(blame.lines.size()).size();
+    std::ostringstream out;
+    for (size_t i = 0; i < blame.lines.size(); ++i)
+        out << blame.lines[i].commit.substr(0, 8) << " " << std::setw(width) << i + 1 << ") " << blame.lines[i].text << "\n";
+    std::cout << out.str();
+    return 0;
+}
+
+// Entries of a directory as of a commit, read from the commit's tree objects
+int listTree(const std::string& commit, const std::string& dir) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) {
+        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
+        return 1;
+    }
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    std::string id = repo->resolveCommit(commit);
+    if (id.empty()) {
+        std::cerr << "Error: Unknown or ambiguous commit.\n";
+        return 1;
+    }
+    codekeeper::Repository::Tree tree;
+    try {
+        tree = repo->listTree(id, fs::absolute(dir.empty() ? "." : dir).lexically_normal().string());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    std::ostringstream out;
+    for (const auto& [name, entry] : tree)
+        out << (entry.directory ? "d " : "f ") << entry.hash << "  " << name << (entry.directory ? "/" : "") << "\n";
+    std::cout << out.str();
+    return 0;
+}
+
+// Restore the whole working tree to a commit
+int checkoutCommit(const std::string& commit, bool force) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) {
+        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
+        return 1;
+    }
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    std::string id = repo->resolveCommit(commit);
+    if (id.empty()) {
+        std::cerr << "Error: Unknown or ambiguous commit.\n";
+        return 1;
+    }
+    codekeeper::Repository::Checkout checkout;
+    try {
+        checkout = repo->checkout(id, force);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << " (or use --force).\n";
+        return 1;
+    }
+    for (const auto& path : checkout.failed) std::cerr << "Error: Unable to write " << path << "\n";
+    for (const auto& path : checkout.mismatched)
+        std::cerr << "Warning: " << path << " was written from a stored version that does not match its recorded hash\n";
+    std::cout << "Checked out " << id.substr(0, 8) << ": " << checkout.written << " file(s) written, "
+              << checkout.removed << " removed, " << checkout.skipped << " unchanged (skipped).\n";
+    return checkout.failed.empty() && checkout.mismatched.empty() ? 0 : 1;
+}
+
+// Recompute commit IDs and rehash stored versions; progress goes to a terminal on stderr
+int verifyRepository(bool full) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) {
+        std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
+        return 1;
+    }
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    codekeeper::VerifyProgress progress;
+    std::atomic<bool> done{false};
+    std::thread reporter;
+    if (isatty(STDERR_FILENO)) {
+        reporter = std::thread([&] {
+            while (!done) {
+                uint64_t total = std::max<uint64_t>(1, progress.bytesTotal);
+                std::cerr << "\rVerifying: " << std::min<uint64_t>(100, progress.bytesDone * 100 / total) << "% ("
+                          << progress.commits << " commits, " << progress.versions << " versions)" << std::flush;
+                for (int i = 0; i < 5 && !done; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            std::cerr << "\r\033[K" << std::flush;
+        });
+    }
+    codekeeper::Repository::Verification result;
+    try {
+        result = repo->verify(full, &progress);
+    } catch (const std::exception& e) {
+        done = true;
+        if (reporter.joinable()) reporter.join();
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    done = true;
+    if (reporter.joinable()) reporter.join();
+    for (const auto& problem : result.problems) std::cout << problem << "\n";
+    if (result.problemCount > result.problems.size())
+        std::cout << "... and " << result.problemCount - result.problems.size() << " more\n";
+    std::cout << "Verified " << result.commits << " commit(s) and " << result.versions << " stored version(s)";
+    if (result.earlier > 0) std::cout << " (" << result.earlier << " earlier commit(s) verified before)";
+    if (result.problemCount == 0) std::cout << ": no problems found.\n";
+    else std::cout << ": " << result.problemCount << " problem(s).\n";
+    return result.problemCount == 0 ? 0 : 1;
+}
+
 // merging branches
 void mergeBranches(const std::string &branch1, const std::string &branch2)
 {
@@ -858,26 +660,43 @@ void mergeBranches(const std::string &branch1, const std::string &branch2)
         return;
     }
 
-    std::string branch1Path = repositoryPath + "/branches/" + branch1;
-    std::string branch2Path = repositoryPath + "/branches/" + branch2;
-
-    if (!fs::exists(branch1Path) || !fs::exists(branch2Path))
+    codekeeper::Repository::BranchMerge merge;
+    try
     {
-        std::cerr << "Error: One or both branches do not exist.\n";
+        merge = codekeeper::Repository::open(repositoryPath)->mergeBranches(branch1, branch2);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << ".\n";
         return;
     }
+    if (merge.base.empty())
+        std::cout << "No common ancestor recorded for these branches; merging two-way.\n";
+    else
+        std::cout << "Merge base: " << merge.base << "\n";
 
-    for (const auto &entry : fs::directory_iterator(branch1Path))
+    size_t merged = 0, identical = 0;
+    std::vector<const codekeeper::Repository::FileMerge *> conflicted;
+    for (const auto &file : merge.files)
     {
-        std::string file1 = entry.path();
-        std::string file2 = branch2Path + "/" + fs::path(file1).filename().string();
-        if (fs::exists(file2))
-        {
-            std::string outputFile = branch1Path + "/merged_" + fs::path(file1).filename().string();
-            mergeFiles(file1, file2, outputFile);
-        }
+        if (file.identical)
+            ++identical;
+        else if (!file.error.empty())
+            std::cerr << "Error: " << file.error << "\n";
+        else
+            ++merged;
+        if (file.conflicts > 0)
+            conflicted.push_back(&file);
+    }
+    std::cout << "Branch merge complete: " << merged << " file(s) merged, " << identical << " identical (skipped), "
+              << conflicted.size() << " with conflicts.\n";
+    if (!conflicted.empty())
+    {
+        std::cout << "Conflicts:\n";
+        for (const auto *file : conflicted)
+            std::cout << "  " << file->output << " (" << file->conflicts << " block(s))\n";
+        std::cout << "Resolve conflicts in the merged files if necessary.\n";
     }
-    std::cout << "Branch merge complete. Resolve conflicts in the merged files if necessary.\n";
 }
 
 
@@ -887,7 +706,7 @@ bool isAuthenticated = false;
 
 // Hash a password (SHA-256 with salt)
 std::string hashPassword(const std::string& username, const std::string& password) {
-    return computeStringHash(username + ":" + password);
+    return codekeeper::hashString(username + ":" + password);
 }
 
 // Register a new user
@@ -995,7 +814,10 @@ void displayHelp()
     std::cout << "  auth                      Authenticate a user.\n";
     std::cout << "  branch [name]             Create a new branch.\n";
     std::cout << "  merge [branch1 branch2]   Merge changes from two branches.\n";
-    std::cout << "  switch [branch]           Switch to a different branch.\n";
+    std::cout << "  switch [branch]           Switch to a branch, rewriting only files that differ.\n";
+    std::cout << "  checkout [commit] [--force]  Restore the whole working tree to a commit.\n";
+    std::cout << "  ls-tree [commit] [dir]    List a directory as of a commit.\n";
+    std::cout << "  verify [--full]           Check commit IDs and stored versions (from the last verified commit).\n";
     std::cout << "  set-remote <path>          Set the remote repository path.\n";
     std::cout << "  push                       Push commits and versions to remote.\n";
     std::cout << "  pull                       Pull commits and versions from remote.\n";
@@ -1003,7 +825,14 @@ void displayHelp()
     std::cout << "  whoami                      Show current authenticated user.\n";
     std::cout << "  list-users                  List all registered users.\n";
     std::cout << "  merge-files <f1> <f2> <out> [--interactive]  Merge two files, optionally interactively.\n";
+    std::cout << "  diff <f1> <f2>              Show the differences between two files (unified format).\n";
+    std::cout << "  diff <commitA> [<commitB>] [path]  Show what a commit changed, or the changes between two commits.\n";
+    std::cout << "  blame <path> [commit]       Show the commit that last changed each line of a file.\n";
     std::cout << "  serve [port] [--dir <path>]  Start web interface.\n";
+    std::cout << "  daemon <start|stop|status>  Keep a resident daemon that answers CLI commands for this repository.\n";
+    std::cout << "\nOptions:\n";
+    std::cout << "  --trace=<file>              Write a Chrome trace of the command (also CODEKEEPER_TRACE=<file>).\n";
+    std::cout << "  --stats                     After the command, print I/O counts, hash throughput, peak RSS and timings.\n";
     std::cout << "\nAuthentication:\n";
     std::cout << "  Users must authenticate using a valid username and password.\n";
     std::cout << "  Only authenticated users can commit, rollback, or resolve conflicts.\n";
@@ -1017,14 +846,15 @@ void status() {
         std::cerr << "Error: Repository not initialized. Run 'codekeeper init'.\n";
         return;
     }
-    fs::path stagingDir = fs::path(repositoryPath) / ".staging";
-    std::vector<std::string> stagedFiles = getStagedFiles();
+    auto repo = codekeeper::Repository::open(repositoryPath);
+    std::vector<std::string> stagedFiles = repo->stagedFiles();
     std::set<std::string> stagedSet;
     for (const auto& f : stagedFiles) stagedSet.insert(fs::path(f).filename().string());
 
     // Get all files in working directory (excluding hidden and repo files)
     std::vector<std::string> workingFiles;
     for (const auto& entry : fs::directory_iterator(fs::current_path())) {
+        codekeeper::stats::add(codekeeper::stats::StatCalls);
         if (fs::is_regular_file(entry)) {
             std::string fname = entry.path().filename().string();
             if (fname[0] == '.' || fname == "commit_log.txt" || fname == "codekeeper.cpp" || fname == "codekeeper.exe") continue;
@@ -1032,21 +862,14 @@ void status() {
         }
     }
 
-    // Get last committed files
+    // Files of the current branch's newest commit
     std::vector<std::string> lastCommitted;
-    fs::path logPath = fs::path(repositoryPath) / "commit_log.txt";
-    if (fs::exists(logPath)) {
-        std::ifstream logFile(logPath);
-        std::string line;
-        while (std::getline(logFile, line)) {
-            // Only use last line
-        }
-        if (!line.empty()) {
-            std::vector<std::string> tokens = split(line, '|');
-            // Files start at index 3, every other token is a file path
-            for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2) {
-                lastCommitted.push_back(fs::path(tokens[i]).filename().string());
-            }
+    std::string tipLine = repo->currentLogLine();
+    if (!tipLine.empty()) {
+        std::vector<std::string> tokens = split(tipLine, '|');
+        // Files start at index 3, every other token is a file path
+        for (size_t i = 3; i < 3 + 2 * ((tokens.size() - 3) / 3); i += 2) {
+            lastCommitted.push_back(fs::path(tokens[i]).filename().string());
         }
     }
     std::set<std::string> committedSet(lastCommitted.begin(), lastCommitted.end());
@@ -1059,20 +882,19 @@ void status() {
         if (committedSet.count(f) && !stagedSet.count(f)) {
             // Compare with last committed version
             // Find version path from log
-            std::ifstream logFile(logPath);
-            std::string line, versionPath;
-            while (std::getline(logFile, line)) {}
-            if (!line.empty()) {
-                std::vector<std::string> tokens = split(line, '|');
-                for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2) {
+            std::string versionPath;
+            if (!tipLine.empty()) {
+                std::vector<std::string> tokens = split(tipLine, '|');
+                size_t n = (tokens.size() - 3) / 3;
+                for (size_t i = 3; i < 3 + 2 * n; i += 2) {
                     if (fs::path(tokens[i]).filename().string() == f) {
-                        size_t half = 3 + (tokens.size() - 4) / 2;
-                        versionPath = tokens[half + (i - 3)];
+                        // Versions follow the file/hash pairs, one per file
+                        versionPath = tokens[3 + 2 * n + (i - 3) / 2];
                         break;
                     }
                 }
             }
-            if (!versionPath.empty() && !filesAreEqual(f, versionPath)) {
+            if (!versionPath.empty() && !repo->sameContent(f, versionPath)) {
                 std::cout << "  " << f << "\n";
             }
         }
@@ -1161,35 +983,7 @@ void listConflicts() {
         std::cerr << "Error: No commit log found.\n";
         return;
     }
-    std::vector<std::string> lastCommitted;
-    std::ifstream logFile(logPath);
-    std::string line;
-    while (std::getline(logFile, line)) {}
-    if (!line.empty()) {
-        std::vector<std::string> tokens = split(line, '|');
-        for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2) {
-            lastCommitted.push_back(fs::path(tokens[i]).filename().string());
-        }
-    }
-    std::set<std::string> conflicts;
-    for (const auto& f : lastCommitted) {
-        std::ifstream logFile2(logPath);
-        std::string line2, versionPath;
-        while (std::getline(logFile2, line2)) {}
-        if (!line2.empty()) {
-            std::vector<std::string> tokens = split(line2, '|');
-            for (size_t i = 3; i < tokens.size() - (tokens.size() - 4) / 2; i += 2) {
-                if (fs::path(tokens[i]).filename().string() == f) {
-                    size_t half = 3 + (tokens.size() - 4) / 2;
-                    versionPath = tokens[half + (i - 3)];
-                    break;
-                }
-            }
-        }
-        if (!versionPath.empty() && fs::exists(f) && !filesAreEqual(f, versionPath)) {
-            conflicts.insert(f);
-        }
-    }
+    std::vector<std::string> conflicts = codekeeper::Repository::open(repositoryPath)->conflicts();
     if (conflicts.empty()) {
         std::cout << "No conflicts detected.\n";
     } else {
@@ -1198,8 +992,10 @@ void listConflicts() {
     }
 }
 
-// Entry point for CodeKeeper CLI
-int main(int argc, char* argv[]) {
+int startDaemon(bool foreground);
+
+// Run one CLI command in this process
+int runCommand(int argc, char* argv[]) {
     if (argc < 2) {
         displayHelp();
         return 1;
@@ -1316,6 +1112,20 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         switchBranch(argv[2]);
+    } else if (cmd == "ls-tree") {
+        if (argc < 3) {
+            std::cerr << "Usage: codekeeper ls-tree <commit> [dir]" << std::endl;
+            return 1;
+        }
+        return listTree(argv[2], argc > 3 ? argv[3] : "");
+    } else if (cmd == "checkout") {
+        if (argc < 3) {
+            std::cerr << "Usage: codekeeper checkout <commit> [--force]" << std::endl;
+            return 1;
+        }
+        return checkoutCommit(argv[2], argc > 3 && std::string(argv[3]) == "--force");
+    } else if (cmd == "verify") {
+        return verifyRepository(argc > 2 && std::string(argv[2]) == "--full");
     } else if (cmd == "set-remote") {
         if (argc < 3) {
             std::cerr << "Usage: codekeeper set-remote <path>" << std::endl;
@@ -1355,17 +1165,36 @@ int main(int argc, char* argv[]) {
         } else {
             mergeFiles(argv[2], argv[3], argv[4]);
         }
+    } else if (cmd == "diff") {
+        if (argc < 3) {
+            std::cerr << "Usage: codekeeper diff <file1> <file2> | <commitA> [<commitB>] [path]" << std::endl;
+            return 1;
+        }
+        // Two files on disk are compared directly; anything else names commits
+        if (argc == 4 && fs::is_regular_file(argv[2]) && fs::is_regular_file(argv[3])) return diffFiles(argv[2], argv[3]);
+        loadRepositoryPath();
+        bool second = argc > 3 && !repositoryPath.empty() &&
+                      !codekeeper::Repository::open(repositoryPath)->resolveCommit(argv[3]).empty();
+        return diffCommits(argv[2], second ? argv[3] : "", argc > (second ? 4 : 3) ? argv[second ? 4 : 3] : "");
+    } else if (cmd == "blame") {
+        if (argc < 3) {
+            std::cerr << "Usage: codekeeper blame <path> [commit]" << std::endl;
+            return 1;
+        }
+        return blameFile(argv[2], argc > 3 ? argv[3] : "");
     } else if (cmd == "serve") {
-        // Launch web server binary
         fs::path exePath = fs::absolute(argv[0]);
+#ifndef CODEKEEPER_WITH_WEB
+        // Launch web server binary
         fs::path webExe = exePath.parent_path() / "codekeeper-web";
         if (!fs::exists(webExe)) {
             webExe = exePath.parent_path() / "build/codekeeper-web";
         }
         if (!fs::exists(webExe)) {
-            std::cerr << "Error: codekeeper-web not found. Build it with: g++ -std=c++17 -Iinclude -o build/codekeeper-web codekeeper-web.cpp -lssl -lcrypto -lpthread" << std::endl;
+            std::cerr << "Error: codekeeper-web not found. Build it with: g++ -std=c++17 -Iinclude -o build/codekeeper-web codekeeper-web.cpp libcodekeeper.cpp -lssl -lcrypto -lpthread" << std::endl;
             return 1;
         }
+#endif
         std::string port = (argc > 2) ? argv[2] : "8080";
         if (port == "--help" || port == "-h") {
             std::cout << "Usage: codekeeper serve [port]" << std::endl;
@@ -1385,6 +1214,12 @@ int main(int argc, char* argv[]) {
             std::cout << "Starting CodeKeeper Web Server..." << std::endl;
             std::cout << "Open http://localhost:" << port << " in your browser." << std::endl;
             std::cout << "Press Ctrl+C to stop." << std::endl << std::endl;
+#ifdef CODEKEEPER_WITH_WEB
+            std::string dir = fs::current_path().string(), web = webDir.string();
+            char* serverArgs[] = {argv[0], &port[0], const_cast<char*>("--dir"), &dir[0],
+                                  const_cast<char*>("--web"), &web[0], nullptr};
+            return codekeeper_web::runServer(6, serverArgs);
+#else
             // Use exec to replace process, passing --web and --dir
             execlp(webExe.c_str(), webExe.c_str(),
                 port.c_str(),
@@ -1394,13 +1229,345 @@ int main(int argc, char* argv[]) {
             // If exec fails, fall back to system()
             std::cerr << "Error: Failed to launch web server." << std::endl;
             return 1;
+#endif
         } else {
             std::cerr << "Error: web/index.html not found. Run from the CodeKeeper project directory." << std::endl;
             std::cerr << "Alternatively, run: codekeeper-web <port> --web <path-to-web-dir>" << std::endl;
             return 1;
         }
+    } else if (cmd == "daemon") {
+        std::string action = (argc > 2) ? argv[2] : "";
+        if (action == "start") return startDaemon(argc > 3 && std::string(argv[3]) == "--foreground");
+        if (action == "stop" || action == "status") {
+            // Reaching this point means no daemon answered
+            std::cout << "No daemon running." << std::endl;
+            return action == "stop" ? 1 : 0;
+        }
+        std::cerr << "Usage: codekeeper daemon <start [--foreground]|stop|status>" << std::endl;
+        return 1;
     } else {
         displayHelp();
     }
     return 0;
 }
+
+// ====== Daemon ======
+// `codekeeper daemon start` keeps one process per repository listening on <repo>/.daemon.sock.
+// The CLI hands it its working directory, arguments and stdin/stdout/stderr (as file
+// descriptors, so output and hooks reach the terminal directly) and waits for the exit code.
+// Commands run one at a time against one long-lived Repository, so its file-hash and log caches
+// stay warm. Without a daemon, or for commands that are not forwarded, the CLI runs in-process
+// as before.
+
+// Commands that behave the same when run by the daemon
+bool forwardable(const std::string& cmd) {
+    static const std::set<std::string> commands = {
+        "add", "reset", "status", "commit", "history", "rollback", "conflicts", "list-conflicts",
+        "branch", "switch", "checkout", "ls-tree", "whoami", "list-users", "daemon"};
+    return commands.count(cmd) > 0;
+}
+
+fs::path daemonSocketPath(const std::string& repoPath) {
+    return fs::path(repoPath) / ".daemon.sock";
+}
+
+bool socketAddress(const fs::path& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.string().size() >= sizeof(addr.sun_path)) return false;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+bool sendAll(int fd, const void* data, size_t n) {
+    const char* p = static_cast<const char*>(data);
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w <= 0) return false;
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+bool recvAll(int fd, void* data, size_t n) {
+    char* p = static_cast<char*>(data);
+    while (n > 0) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r <= 0) return false;
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+// Request: [uint32 count] then count x ([uint32 length] bytes): cwd, argv[1..]. The first
+// byte travels with SCM_RIGHTS carrying the client's fds 0, 1 and 2.
+bool sendRequest(int sock, const std::vector<std::string>& parts) {
+    uint32_t count = parts.size();
+    char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    struct iovec iov = {&count, sizeof(count)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(count)) return false;
+    for (const auto& part : parts) {
+        uint32_t len = part.size();
+        if (!sendAll(sock, &len, sizeof(len)) || !sendAll(sock, part.data(), part.size())) return false;
+    }
+    return true;
+}
+
+bool receiveRequest(int sock, std::vector<std::string>& parts, int fds[3]) {
+    uint32_t count = 0;
+    char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    struct iovec iov = {&count, sizeof(count)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(count)) return false;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) return false;
+    std::memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    if (count < 2 || count > 4096) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t len = 0;
+        if (!recvAll(sock, &len, sizeof(len)) || len > (64u << 20)) return false;
+        std::string part(len, '\0');
+        if (len > 0 && !recvAll(sock, &part[0], len)) return false;
+        parts.push_back(std::move(part));
+    }
+    return true;
+}
+
+// Hand the command to the repository's daemon. False if none is reachable, leaving the caller
+// to run it in-process.
+bool forwardToDaemon(int argc, char* argv[], int& exitCode) {
+    std::string repoPath = getCentralRepositoryPath();
+    sockaddr_un addr;
+    if (repoPath.empty() || !socketAddress(daemonSocketPath(repoPath), addr)) return false;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return false;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(sock);
+        return false;
+    }
+    std::vector<std::string> parts = {fs::current_path().string()};
+    for (int i = 1; i < argc; ++i) parts.push_back(argv[i]);
+    int32_t code = 1;
+    bool ok = sendRequest(sock, parts) && recvAll(sock, &code, sizeof(code));
+    close(sock);
+    if (!ok) {
+        std::cerr << "Error: Lost connection to the CodeKeeper daemon." << std::endl;
+        code = 1;
+    }
+    exitCode = code;
+    return true;
+}
+
+// Run one forwarded command with the client's cwd and standard streams
+int serveRequest(std::vector<std::string>& parts, int fds[3], bool& stop) {
+    std::string cwd = parts[0];
+    std::vector<char*> args = {const_cast<char*>("codekeeper")};
+    for (size_t i = 1; i < parts.size(); ++i) args.push_back(&parts[i][0]);
+    args.push_back(nullptr);
+    int argc = static_cast<int>(args.size() - 1);
+
+    std::cout.flush();
+    std::cerr.flush();
+    int saved[3];
+    for (int i = 0; i < 3; ++i) {
+        saved[i] = dup(i);
+        dup2(fds[i], i);
+    }
+    std::cin.clear();
+    fs::path home = fs::current_path();
+    int code = 1;
+    std::error_code ec;
+    fs::current_path(cwd, ec);
+    if (ec) {
+        std::cerr << "Error: Cannot enter " << cwd << ": " << ec.message() << std::endl;
+    } else if (!forwardable(parts[1])) {
+        std::cerr << "Error: '" << parts[1] << "' cannot run in the daemon." << std::endl;
+    } else if (parts[1] == "daemon") {
+        std::string action = argc > 2 ? args[2] : "";
+        if (action == "status" || action == "start") {
+            std::cout << "Daemon running (pid " << getpid() << ")." << std::endl;
+            code = action == "status" ? 0 : 1;
+        } else if (action == "stop") {
+            std::cout << "Daemon stopped." << std::endl;
+            stop = true;
+            code = 0;
+        } else {
+            code = runCommand(argc, args.data());
+        }
+    } else {
+        try {
+            code = runCommand(argc, args.data());
+        } catch (std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+    fs::current_path(home, ec);
+    std::cout.flush();
+    std::cerr.flush();
+    for (int i = 0; i < 3; ++i) {
+        dup2(saved[i], i);
+        close(saved[i]);
+        close(fds[i]);
+    }
+    return code;
+}
+
+int startDaemon(bool foreground) {
+    loadRepositoryPath();
+    if (repositoryPath.empty()) return 1;
+    fs::path sockPath = daemonSocketPath(fs::weakly_canonical(repositoryPath).string());
+    sockaddr_un addr;
+    if (!socketAddress(sockPath, addr)) {
+        std::cerr << "Error: Repository path too long for a daemon socket." << std::endl;
+        return 1;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    // Nothing answered (forwardToDaemon already tried), so an existing socket file is stale
+    fs::remove(sockPath);
+    mode_t oldMask = umask(0077);
+    bool bound = sock >= 0 && bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(sock, 64) == 0;
+    umask(oldMask);
+    if (!bound) {
+        std::cerr << "Error: Cannot listen on " << sockPath << ": " << std::strerror(errno) << std::endl;
+        if (sock >= 0) close(sock);
+        return 1;
+    }
+    if (!foreground) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "Error: Cannot start daemon." << std::endl;
+            return 1;
+        }
+        if (pid > 0) {
+            std::cout << "Daemon started (pid " << pid << "), listening on " << sockPath.string() << std::endl;
+            return 0;
+        }
+        setsid();
+        int devNull = open("/dev/null", O_RDWR);
+        for (int i = 0; i < 3; ++i) dup2(devNull, i);
+        if (devNull > 2) close(devNull);
+    } else {
+        std::cout << "Daemon listening on " << sockPath.string() << std::endl;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // Holding the engine keeps its caches alive between commands
+    auto warm = codekeeper::Repository::open(repositoryPath);
+    bool stop = false;
+    while (!stop) {
+        int client = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        // Only the owner may drive the daemon
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        std::vector<std::string> parts;
+        int fds[3] = {-1, -1, -1};
+        if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid() &&
+            receiveRequest(client, parts, fds)) {
+            int32_t code = serveRequest(parts, fds, stop);
+            sendAll(client, &code, sizeof(code));
+        } else {
+            for (int fd : fds) if (fd >= 0) close(fd);
+        }
+        close(client);
+    }
+    close(sock);
+    fs::remove(sockPath);
+    return 0;
+}
+
+// --stats report, on stderr so the command's own output stays parseable
+std::string byteCount(uint64_t bytes) {
+    static const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024;
+        ++unit;
+    }
+    std::ostringstream out;
+    out << bytes << " (" << std::fixed << std::setprecision(unit ? 1 : 0) << value << " " << units[unit] << ")";
+    return out.str();
+}
+
+void printStats(const std::string& command, std::chrono::steady_clock::time_point start) {
+    using namespace codekeeper::stats;
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    auto ms = [](const timeval& tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+    double userMs = ms(usage.ru_utime), sysMs = ms(usage.ru_stime);
+    uint64_t hashed = counters[BytesHashed], hashNanos = counters[HashNanos];
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "--- stats: " << (command.empty() ? "(none)" : command) << " ---\n";
+    out << "wall time      " << wallMs << " ms\n";
+    out << "cpu time       " << userMs + sysMs << " ms (user " << userMs << ", sys " << sysMs << ")\n";
+    out << "peak RSS       " << byteCount(static_cast<uint64_t>(usage.ru_maxrss) * 1024) << "\n";
+    out << "files opened   " << counters[FilesOpened] << "\n";
+    out << "stat calls     " << counters[StatCalls] << "\n";
+    out << "bytes read     " << byteCount(counters[BytesRead]) << "\n";
+    out << "bytes written  " << byteCount(counters[BytesWritten]) << "\n";
+    out << "hashed         " << byteCount(hashed) << " in " << hashNanos / 1e6 << " ms";
+    if (hashNanos > 0) out << " (" << hashed / (hashNanos / 1e9) / (1 << 20) << " MiB/s)";
+    out << "\n";
+    std::cerr << out.str();
+}
+
+// Entry point for CodeKeeper CLI
+int main(int argc, char* argv[]) {
+    auto start = std::chrono::steady_clock::now();
+    // --trace=<file> and --stats may appear anywhere; they are taken out before the command sees
+    // its arguments
+    std::vector<char*> args;
+    std::string traceFile;
+    bool stats = false;
+    for (int i = 0; i < argc; ++i) {
+        if (i > 0 && std::strncmp(argv[i], "--trace=", 8) == 0) traceFile = argv[i] + 8;
+        else if (i > 0 && std::strcmp(argv[i], "--stats") == 0) stats = true;
+        else args.push_back(argv[i]);
+    }
+    argc = static_cast<int>(args.size());
+    args.push_back(nullptr);
+    argv = args.data();
+    if (!traceFile.empty()) codekeeper::trace::start(traceFile);
+    else codekeeper::trace::startFromEnvironment();
+
+    codekeeper::stats::enabled = stats;
+
+    // Traced and --stats commands run in-process so what they measure is this process
+    int exitCode = 0;
+    if (!codekeeper::trace::active && !stats && argc >= 2 && forwardable(argv[1]) &&
+        forwardToDaemon(argc, argv, exitCode))
+        return exitCode;
+    {
+        codekeeper::trace::Span span("command", argc >= 2 ? std::string(argv[1]) : std::string());
+        exitCode = runCommand(argc, argv);
+    }
+    codekeeper::trace::stop();
+    if (stats) {
+        std::cout.flush();
+        printStats(argc >= 2 ? argv[1] : "", start);
+    }
+    return exitCode;
+}
@@ -0,0 +1,2631 @@
+#include "libcodekeeper.h"
+#include "codekeeper-json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <openssl/evp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace codekeeper {
+
+std::string timestamp() {
+    std::time_t now = std::time(nullptr);
+    char buf[80];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+    return buf;
+}
+
+std::vector<std::string> split(const std::string& str, char delimiter) {
+    std::vector<std::string> tokens;
+    std::stringstream ss(str);
+    std::string token;
+    while (std::getline(ss, token, delimiter)) tokens.push_back(token);
+    return tokens;
+}
+
+// Escape special characters for log safety
+std::string escapeField(const std::string& input) {
+    std::string output;
+    for (char c : input) {
+        if (c == '|') output += "\\|";
+        else output += c;
+    }
+    return output;
+}
+
+static std::string toHex(const unsigned char* bytes, unsigned int length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string result(length * 2, '0');
+    for (unsigned int i = 0; i < length; ++i) {
+        result[2 * i] = digits[bytes[i] >> 4];
+        result[2 * i + 1] = digits[bytes[i] & 0xf];
+    }
+    return result;
+}
+
+// One digest context per thread, reset between uses instead of allocated per file
+static EVP_MD_CTX* threadDigest() {
+    struct Free {
+        void operator()(EVP_MD_CTX* ctx) const { EVP_MD_CTX_free(ctx); }
+    };
+    thread_local std::unique_ptr<EVP_MD_CTX, Free> ctx(EVP_MD_CTX_new());
+    return ctx.get();
+}
+
+std::string hashString(const std::string& input) {
+    EVP_MD_CTX* ctx = threadDigest();
+    if (!ctx) return "";
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1 ||
+        EVP_DigestUpdate(ctx, input.c_str(), input.size()) != 1 ||
+        EVP_DigestFinal_ex(ctx, hash, &length) != 1) {
+        return "";
+    }
+    return toHex(hash, length);
+}
+
+// Files at least this large are mapped and digested in one call; smaller ones are read in
+// 256 KiB chunks. Either way OpenSSL's SHA-256 uses the SHA-NI / AVX2 code paths when the CPU
+// has them, so the digest rather than the I/O loop sets the pace.
+static constexpr off_t kMapThreshold = 1 << 20;
+static constexpr size_t kReadChunk = 256 * 1024;
+
+std::string hashFile(const fs::path& filePath) {
+    trace::Span span("hashFile", filePath.string());
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "";
+    stats::add(stats::FilesOpened);
+    auto start = std::chrono::steady_clock::now();
+    EVP_MD_CTX* ctx = threadDigest();
+    struct stat st;
+    bool ok = ctx && fstat(fd, &st) == 0 && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1;
+    uint64_t total = 0;
+    bool mapped = false;
+    if (ok && S_ISREG(st.st_mode) && st.st_size >= kMapThreshold) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            ok = EVP_DigestUpdate(ctx, data, st.st_size) == 1;
+            total = st.st_size;
+            munmap(data, st.st_size);
+            mapped = true;
+        }
+    }
+    if (ok && !mapped) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        thread_local std::unique_ptr<char[]> buffer(new char[kReadChunk]);
+        ssize_t n;
+        while ((n = read(fd, buffer.get(), kReadChunk)) > 0) {
+            total += n;
+            if (EVP_DigestUpdate(ctx, buffer.get(), n) != 1) {
+                ok = false;
+                break;
+            }
+        }
+        if (n < 0) ok = false;
+    }
+    close(fd);
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen = 0;
+    if (!ok || EVP_DigestFinal_ex(ctx, hash, &hashLen) != 1) return "";
+    stats::add(stats::BytesRead, total);
+    stats::add(stats::BytesHashed, total);
+    stats::add(stats::HashNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    return toHex(hash, hashLen);
+}
+
+// fn(0) .. fn(count - 1) on up to 8 threads (the caller's included), about one thread per
+// `grain` items so that small batches stay on the calling thread
+static void parallelFor(size_t count, size_t grain, const std::function<void(size_t)>& fn) {
+    size_t workers = std::min<size_t>({std::max(1u, std::thread::hardware_concurrency()), 8,
+                                       (count + grain - 1) / grain});
+    std::atomic<size_t> next{0};
+    auto work = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) fn(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < workers; ++t) threads.emplace_back(work);
+    work();
+    for (auto& t : threads) t.join();
+}
+
+std::vector<std::string> hashFiles(const std::vector<fs::path>& files,
+                                   const std::function<void(size_t)>& onHashed) {
+    std::vector<std::string> hashes(files.size());
+    // Small batches are not worth a thread; large ones keep several cores on the digest
+    parallelFor(files.size(), 16, [&](size_t i) {
+        hashes[i] = hashFile(files[i]);
+        if (onHashed) onHashed(i);
+    });
+    return hashes;
+}
+
+std::vector<std::string> collectFiles(const std::string& path) {
+    trace::Span span("collectFiles", path);
+    std::vector<std::string> files;
+    fs::path p = fs::absolute(path);
+    stats::add(stats::StatCalls);
+    if (!fs::exists(p)) return files;
+    if (fs::is_regular_file(p)) {
+        files.push_back(p.string());
+    } else if (fs::is_directory(p)) {
+        for (const auto& entry : fs::recursive_directory_iterator(p)) {
+            stats::add(stats::StatCalls);
+            if (fs::is_regular_file(entry)) {
+                std::string fname = entry.path().filename().string();
+                // Skip hidden files, repo internals, and the binary
+                if (fname[0] == '.' || fname == "commit_log.txt" || fname == "codekeeper" || fname == "codekeeper.exe") continue;
+                // Skip files inside repo-internal directories (.staging, versions, branches)
+                auto rel = fs::relative(entry.path(), p);
+                bool inInternal = false;
+                for (const auto& part : rel) {
+                    std::string s = part.string();
+                    if (s == ".staging" || s == "versions" || s == "branches" || s[0] == '.') { inInternal = true; break; }
+                }
+                if (!inInternal) files.push_back(fs::absolute(entry.path()).string());
+            }
+        }
+    }
+    return files;
+}
+
+// ---- Diff ----
+
+std::vector<std::string_view> splitLines(std::string_view text) {
+    std::vector<std::string_view> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t nl = text.find('\n', start);
+        size_t end = nl == std::string_view::npos ? text.size() : nl + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+namespace {
+
+constexpr uint32_t kNone = UINT32_MAX;
+// Lines occurring more often than this in a region are not used to split it (git's limit)
+constexpr uint32_t kMaxChain = 64;
+// Deepest histogram recursion, and the most Myers edit steps per region, before settling for
+// a less minimal (still correct) diff
+constexpr int kMaxDepth = 256;
+constexpr long kMaxMyersCost = 4096;
+
+// Both sides as dense line ids, plus scratch space reused across the recursion
+class LineDiff {
+public:
+    LineDiff(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b) {
+        std::unordered_map<std::string_view, uint32_t> ids;
+        ids.reserve(a.size() + b.size());
+        auto intern = [&](std::string_view line) {
+            return ids.emplace(line, static_cast<uint32_t>(ids.size())).first->second;
+        };
+        A_.reserve(a.size());
+        B_.reserve(b.size());
+        for (auto line : a) A_.push_back(intern(line));
+        for (auto line : b) B_.push_back(intern(line));
+        count_.assign(ids.size(), 0);
+        head_.assign(ids.size(), kNone);
+        next_.assign(A_.size(), kNone);
+    }
+
+    // Matched (a, b) line pairs, increasing in both
+    std::vector<std::pair<size_t, size_t>> run() {
+        histogram(0, A_.size(), 0, B_.size(), 0);
+        return std::move(matches_);
+    }
+
+private:
+    void match(size_t a, size_t b, size_t n) {
+        for (size_t i = 0; i < n; ++i) matches_.emplace_back(a + i, b + i);
+    }
+
+    void histogram(size_t a0, size_t a1, size_t b0, size_t b1, int depth) {
+        size_t prefix = 0;
+        while (a0 + prefix < a1 && b0 + prefix < b1 && A_[a0 + prefix] == B_[b0 + prefix]) ++prefix;
+        match(a0, b0, prefix);
+        a0 += prefix;
+        b0 += prefix;
+        size_t suffix = 0;
+        while (a0 < a1 - suffix && b0 < b1 - suffix && A_[a1 - suffix - 1] == B_[b1 - suffix - 1]) ++suffix;
+        a1 -= suffix;
+        b1 -= suffix;
+
+        if (a0 < a1 && b0 < b1) {
+            size_t as = 0, ae = 0, bs = 0, be = 0;
+            bool common = false;
+            if (depth < kMaxDepth && findSplit(a0, a1, b0, b1, as, ae, bs, be, common)) {
+                histogram(a0, as, b0, bs, depth + 1);
+                match(as, bs, ae - as);
+                histogram(ae, a1, be, b1, depth + 1);
+            } else if (common) {
+                myers(a0, a1, b0, b1);
+            }
+        }
+        match(a1, b1, suffix);
+    }
+
+    // Longest run of equal lines whose rarest line (counted in A's region) is as rare as possible.
+    // [as, ae) in A matches [bs, be) in B. `common` tells whether the regions share any line.
+    bool findSplit(size_t a0, size_t a1, size_t b0, size_t b1, size_t& as, size_t& ae, size_t& bs, size_t& be,
+                   bool& common) {
+        // Chains of each line's positions in A, ascending
+        for (size_t i = a1; i-- > a0;) {
+            uint32_t id = A_[i];
+            next_[i] = head_[id];
+            head_[id] = static_cast<uint32_t>(i);
+            ++count_[id];
+        }
+        common = false;
+        uint32_t bestCount = kMaxChain + 1;
+        size_t bestLength = 0;
+        for (size_t b = b0; b < b1;) {
+            size_t bNext = b + 1;
+            uint32_t id = B_[b];
+            if (count_[id] > 0) common = true;
+            if (count_[id] == 0 || count_[id] > kMaxChain || count_[id] > bestCount) {
+                b = bNext;
+                continue;
+            }
+            for (uint32_t a = head_[id]; a != kNone;) {
+                size_t s = a, t = b, e = a + 1, f = b + 1;
+                uint32_t rarest = count_[id];
+                while (s > a0 && t > b0 && A_[s - 1] == B_[t - 1]) {
+                    --s;
+                    --t;
+                    rarest = std::min(rarest, count_[A_[s]]);
+                }
+                while (e < a1 && f < b1 && A_[e] == B_[f]) {
+                    rarest = std::min(rarest, count_[A_[e]]);
+                    ++e;
+                    ++f;
+                }
+                if (bNext < f) bNext = f;
+                if (e - s > bestLength || rarest < bestCount) {
+                    as = s;
+                    ae = e;
+                    bs = t;
+                    be = f;
+                    bestLength = e - s;
+                    bestCount = rarest;
+                }
+                // Occurrences inside this run would only find the same run again
+                while (a != kNone && a < e) a = next_[a];
+            }
+            b = bNext;
+        }
+        for (size_t i = a0; i < a1; ++i) {
+            count_[A_[i]] = 0;
+            head_[A_[i]] = kNone;
+        }
+        return bestLength > 0;
+    }
+
+    // Myers' O(ND) bisection (as in diff-match-patch): walk from both ends until the paths meet,
+    // then diff the two halves. Called on regions that share no prefix or suffix.
+    void myers(size_t a0, size_t a1, size_t b0, size_t b1) {
+        long n = static_cast<long>(a1 - a0), m = static_cast<long>(b1 - b0);
+        long maxD = std::min((n + m + 1) / 2, kMaxMyersCost);
+        long offset = maxD + 1;
+        std::vector<long> v1(2 * offset + 2, -1), v2(2 * offset + 2, -1);
+        v1[offset + 1] = 0;
+        v2[offset + 1] = 0;
+        long delta = n - m;
+        bool front = delta % 2 != 0;
+        long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+        for (long d = 0; d < maxD; ++d) {
+            for (long k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+                long k1o = offset + k1;
+                long x1 = (k1 == -d || (k1 != d && v1[k1o - 1] < v1[k1o + 1])) ? v1[k1o + 1] : v1[k1o - 1] + 1;
+                long y1 = x1 - k1;
+                while (x1 < n && y1 < m && A_[a0 + x1] == B_[b0 + y1]) {
+                    ++x1;
+                    ++y1;
+                }
+                v1[k1o] = x1;
+                if (x1 > n) {
+                    k1end += 2;
+                } else if (y1 > m) {
+                    k1start += 2;
+                } else if (front) {
+                    long k2o = offset + delta - k1;
+                    if (k2o >= 0 && k2o < static_cast<long>(v2.size()) && v2[k2o] != -1 && x1 >= n - v2[k2o])
+                        return bisect(a0, a1, b0, b1, x1, y1);
+                }
+            }
+            for (long k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+                long k2o = offset + k2;
+                long x2 = (k2 == -d || (k2 != d && v2[k2o - 1] < v2[k2o + 1])) ? v2[k2o + 1] : v2[k2o - 1] + 1;
+                long y2 = x2 - k2;
+                while (x2 < n && y2 < m && A_[a1 - x2 - 1] == B_[b1 - y2 - 1]) {
+                    ++x2;
+                    ++y2;
+                }
+                v2[k2o] = x2;
+                if (x2 > n) {
+                    k2end += 2;
+                } else if (y2 > m) {
+                    k2start += 2;
+                } else if (!front) {
+                    long k1o = offset + delta - k2;
+                    if (k1o >= 0 && k1o < static_cast<long>(v1.size()) && v1[k1o] != -1) {
+                        long x1 = v1[k1o];
+                        long y1 = offset + x1 - k1o;
+                        if (x1 >= n - x2) return bisect(a0, a1, b0, b1, x1, y1);
+                    }
+                }
+            }
+        }
+        // No overlap within the cost limit: the region is left as one replacement
+    }
+
+    void bisect(size_t a0, size_t a1, size_t b0, size_t b1, long x, long y) {
+        histogramOrMyers(a0, a0 + x, b0, b0 + y);
+        histogramOrMyers(a0 + x, a1, b0 + y, b1);
+    }
+
+    // Halves of a bisection get the same prefix/suffix trimming, then Myers again
+    void histogramOrMyers(size_t a0, size_t a1, size_t b0, size_t b1) {
+        size_t prefix = 0;
+        while (a0 + prefix < a1 && b0 + prefix < b1 && A_[a0 + prefix] == B_[b0 + prefix]) ++prefix;
+        match(a0, b0, prefix);
+        a0 += prefix;
+        b0 += prefix;
+        size_t suffix = 0;
+        while (a0 < a1 - suffix && b0 < b1 - suffix && A_[a1 - suffix - 1] == B_[b1 - suffix - 1]) ++suffix;
+        if (a0 < a1 - suffix && b0 < b1 - suffix) myers(a0, a1 - suffix, b0, b1 - suffix);
+        match(a1 - suffix, b1 - suffix, suffix);
+    }
+
+    std::vector<uint32_t> A_, B_;
+    std::vector<uint32_t> count_, head_, next_;
+    std::vector<std::pair<size_t, size_t>> matches_;
+};
+
+}  // namespace
+
+std::vector<DiffChunk> diffLines(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b) {
+    trace::Span span("diffLines");
+    std::vector<DiffChunk> chunks;
+    size_t ai = 0, bi = 0;
+    auto gap = [&](size_t aEnd, size_t bEnd) {
+        if (aEnd > ai || bEnd > bi) chunks.push_back({ai, aEnd - ai, bi, bEnd - bi});
+        ai = aEnd + 1;
+        bi = bEnd + 1;
+    };
+    for (const auto& [am, bm] : LineDiff(a, b).run()) gap(am, bm);
+    if (a.size() > ai || b.size() > bi) chunks.push_back({ai, a.size() - ai, bi, b.size() - bi});
+    return chunks;
+}
+
+static void appendLine(std::string& out, char prefix, std::string_view line) {
+    out += prefix;
+    out.append(line.data(), line.size());
+    if (line.empty() || line.back() != '\n') out += "\n\\ No newline at end of file\n";
+}
+
+std::string unifiedDiff(const std::string& aName, std::string_view aText, const std::string& bName,
+                        std::string_view bText, size_t context) {
+    auto a = splitLines(aText);
+    auto b = splitLines(bText);
+    auto chunks = diffLines(a, b);
+    std::string out;
+    if (chunks.empty()) return out;
+    out += "--- " + aName + "\n+++ " + bName + "\n";
+    // Chunks closer than twice the context share a hunk
+    for (size_t first = 0; first < chunks.size();) {
+        size_t last = first;
+        while (last + 1 < chunks.size() &&
+               chunks[last + 1].aStart - (chunks[last].aStart + chunks[last].aCount) <= 2 * context)
+            ++last;
+        size_t aStart = chunks[first].aStart - std::min(context, chunks[first].aStart);
+        size_t bStart = chunks[first].bStart - (chunks[first].aStart - aStart);
+        size_t aEnd = std::min(a.size(), chunks[last].aStart + chunks[last].aCount + context);
+        size_t bEnd = bStart + (aEnd - aStart) + [&] {
+            long net = 0;
+            for (size_t c = first; c <= last; ++c) net += long(chunks[c].bCount) - long(chunks[c].aCount);
+            return net;
+        }();
+        // Unified format numbers an empty range by the line before it
+        auto range = [](size_t start, size_t count) {
+            return std::to_string(count ? start + 1 : start) + "," + std::to_string(count);
+        };
+        out += "@@ -" + range(aStart, aEnd - aStart) + " +" + range(bStart, bEnd - bStart) + " @@\n";
+        size_t ai = aStart;
+        for (size_t c = first; c <= last; ++c) {
+            for (; ai < chunks[c].aStart; ++ai) appendLine(out, ' ', a[ai]);
+            for (size_t i = 0; i < chunks[c].aCount; ++i) appendLine(out, '-', a[chunks[c].aStart + i]);
+            for (size_t i = 0; i < chunks[c].bCount; ++i) appendLine(out, '+', b[chunks[c].bStart + i]);
+            ai = chunks[c].aStart + chunks[c].aCount;
+        }
+        for (; ai < aEnd; ++ai) appendLine(out, ' ', a[ai]);
+        first = last + 1;
+    }
+    return out;
+}
+
+static void appendBlock(std::string& out, const std::vector<std::string_view>& lines, size_t start, size_t count) {
+    for (size_t i = 0; i < count; ++i) out.append(lines[start + i].data(), lines[start + i].size());
+    if (count > 0 && lines[start + count - 1].back() != '\n') out += '\n';
+}
+
+MergeResult mergeTwoWay(std::string_view ours, std::string_view theirs, const std::string& oursLabel,
+                        const std::string& theirsLabel) {
+    auto a = splitLines(ours);
+    auto b = splitLines(theirs);
+    MergeResult result;
+    size_t ai = 0;
+    for (const auto& c : diffLines(a, b)) {
+        appendBlock(result.text, a, ai, c.aStart - ai);
+        if (c.aCount == 0 || c.bCount == 0) {
+            // Only one side has lines here: keep them
+            appendBlock(result.text, a, c.aStart, c.aCount);
+            appendBlock(result.text, b, c.bStart, c.bCount);
+        } else {
+            result.text += "<<<<<<< " + oursLabel + "\n";
+            appendBlock(result.text, a, c.aStart, c.aCount);
+            result.text += "=======\n";
+            appendBlock(result.text, b, c.bStart, c.bCount);
+            result.text += ">>>>>>> " + theirsLabel + "\n";
+            ++result.conflicts;
+        }
+        ai = c.aStart + c.aCount;
+    }
+    appendBlock(result.text, a, ai, a.size() - ai);
+    return result;
+}
+
+MergeResult mergeThreeWay(std::string_view base, std::string_view ours, std::string_view theirs,
+                          const std::string& oursLabel, const std::string& theirsLabel) {
+    auto o = splitLines(base);
+    auto a = splitLines(ours);
+    auto b = splitLines(theirs);
+    auto ca = diffLines(o, a);
+    auto cb = diffLines(o, b);
+    MergeResult result;
+    auto emit = [&](std::string_view line) {
+        if (!result.text.empty() && result.text.back() != '\n') result.text += '\n';
+        result.text.append(line.data(), line.size());
+    };
+    // One side's text for base[from, to), from its chunks [first, last) that lie inside it
+    auto side = [&](const std::vector<std::string_view>& lines, const std::vector<DiffChunk>& chunks, size_t first,
+                    size_t last, size_t from, size_t to) {
+        std::vector<std::string_view> out;
+        size_t pos = from;
+        for (size_t c = first; c < last; ++c) {
+            for (; pos < chunks[c].aStart; ++pos) out.push_back(o[pos]);
+            for (size_t i = 0; i < chunks[c].bCount; ++i) out.push_back(lines[chunks[c].bStart + i]);
+            pos = chunks[c].aStart + chunks[c].aCount;
+        }
+        for (; pos < to; ++pos) out.push_back(o[pos]);
+        return out;
+    };
+
+    size_t i = 0, j = 0, pos = 0;
+    while (i < ca.size() || j < cb.size()) {
+        // A region starts at the next change on either side and takes in every change from either
+        // side that overlaps or touches it
+        size_t from = std::min(i < ca.size() ? ca[i].aStart : o.size(), j < cb.size() ? cb[j].aStart : o.size());
+        size_t to = from, i0 = i, j0 = j;
+        for (bool grew = true; grew;) {
+            grew = false;
+            if (i < ca.size() && ca[i].aStart <= to) {
+                to = std::max(to, ca[i].aStart + ca[i].aCount);
+                ++i;
+                grew = true;
+            }
+            if (j < cb.size() && cb[j].aStart <= to) {
+                to = std::max(to, cb[j].aStart + cb[j].aCount);
+                ++j;
+                grew = true;
+            }
+        }
+        for (; pos < from; ++pos) emit(o[pos]);
+        if (j == j0) {
+            for (auto line : side(a, ca, i0, i, from, to)) emit(line);
+        } else if (i == i0) {
+            for (auto line : side(b, cb, j0, j, from, to)) emit(line);
+        } else {
+            auto x = side(a, ca, i0, i, from, to);
+            auto y = side(b, cb, j0, j, from, to);
+            if (x == y) {
+                // Both sides made the same change
+                for (auto line : x) emit(line);
+            } else {
+                emit("<<<<<<< " + oursLabel + "\n");
+                for (auto line : x) emit(line);
+                emit("=======\n");
+                for (auto line : y) emit(line);
+                emit(">>>>>>> " + theirsLabel + "\n");
+                ++result.conflicts;
+            }
+        }
+        pos = to;
+    }
+    for (; pos < o.size(); ++pos) emit(o[pos]);
+    return result;
+}
+
+// ---- Tracing ----
+
+namespace trace {
+
+std::atomic<bool> active{false};
+
+namespace {
+
+struct Event {
+    std::string name;
+    std::string detail;
+    uint64_t ts;    // microseconds since start()
+    uint64_t dur;
+};
+
+// Each thread appends to its own buffer; the lock is only contended while stop() writes
+struct ThreadBuffer {
+    std::mutex mutex;
+    uint64_t tid = 0;
+    std::vector<Event> events;
+};
+
+struct Collector {
+    std::mutex mutex;
+    std::string file;
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    std::atomic<int64_t> originNanos{0};
+    std::atomic<uint64_t> recorded{0};
+    std::atomic<uint64_t> dropped{0};
+};
+
+// Bounds memory on very large commits (a span per file); later spans are counted, not kept
+constexpr uint64_t kMaxEvents = 4000000;
+
+Collector& collector() {
+    static Collector c;
+    return c;
+}
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ThreadBuffer& localBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        buffer->tid = static_cast<uint64_t>(syscall(SYS_gettid));
+        Collector& c = collector();
+        std::lock_guard<std::mutex> lock(c.mutex);
+        c.threads.push_back(buffer);
+    }
+    return *buffer;
+}
+
+}  // namespace
+
+bool start(const std::string& file) {
+    Collector& c = collector();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    if (active || file.empty()) return false;
+    c.file = file;
+    c.originNanos = nowNanos();
+    c.recorded = 0;
+    c.dropped = 0;
+    active = true;
+    return true;
+}
+
+bool startFromEnvironment() {
+    const char* file = std::getenv("CODEKEEPER_TRACE");
+    return file && *file && start(file);
+}
+
+void stop() {
+    Collector& c = collector();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    if (!active) return;
+    active = false;
+    std::ofstream out(c.file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Error: Cannot write trace file " << c.file << "\n";
+    }
+    JsonWriter w([&out](const char* data, size_t n) { return static_cast<bool>(out.write(data, n)); });
+    uint64_t pid = static_cast<uint64_t>(getpid());
+    w.beginObject().key("displayTimeUnit").string("ms").key("traceEvents").beginArray();
+    for (auto& buffer : c.threads) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        for (const auto& e : buffer->events) {
+            w.beginObject().key("args").beginObject();
+            if (!e.detail.empty()) w.key("detail").string(e.detail);
+            w.endObject();
+            w.key("cat").string("codekeeper").key("dur").number(e.dur).key("name").string(e.name);
+            w.key("ph").string("X").key("pid").number(pid).key("tid").number(buffer->tid).key("ts").number(e.ts);
+            w.endObject();
+        }
+        buffer->events.clear();
+        buffer->events.shrink_to_fit();
+    }
+    w.endArray().endObject();
+    w.flush();
+    if (c.dropped > 0)
+        std::cerr << "Trace: kept the first " << kMaxEvents << " spans, dropped " << c.dropped << ".\n";
+}
+
+void Span::begin(const char* name, const std::string* detail) {
+    name_ = name;
+    if (detail) detail_ = *detail;
+    startNanos_ = nowNanos();
+}
+
+void Span::end() {
+    int64_t endNanos = nowNanos();
+    Collector& c = collector();
+    if (!active.load(std::memory_order_relaxed)) return;
+    if (c.recorded.fetch_add(1, std::memory_order_relaxed) >= kMaxEvents) {
+        c.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    int64_t origin = c.originNanos.load(std::memory_order_relaxed);
+    uint64_t ts = startNanos_ > origin ? (startNanos_ - origin) / 1000 : 0;
+    uint64_t dur = (endNanos - std::max(startNanos_, origin)) / 1000;
+    ThreadBuffer& buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({name_, std::move(detail_), ts, dur});
+}
+
+}  // namespace trace
+
+// ---- I/O statistics ----
+
+namespace stats {
+
+std::atomic<bool> enabled{false};
+std::atomic<uint64_t> counters[CounterCount] = {};
+
+}  // namespace stats
+
+// Small repository files (.staging_index, .bypass, ...) are read and written whole through
+// these, so --stats sees them
+static std::vector<std::string> readLines(const fs::path& path) {
+    std::vector<std::string> lines;
+    std::ifstream f(path);
+    if (!f.is_open()) return lines;
+    stats::add(stats::FilesOpened);
+    std::string line;
+    while (std::getline(f, line)) {
+        stats::add(stats::BytesRead, line.size() + 1);
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+static bool writeText(const fs::path& path, const std::string& text, std::ios::openmode mode = std::ios::trunc) {
+    std::ofstream f(path, mode);
+    f << text;
+    stats::add(stats::FilesOpened);
+    stats::add(stats::BytesWritten, text.size());
+    return static_cast<bool>(f);
+}
+
+// Whole file into `text`; false if it cannot be opened
+static bool readText(const fs::path& path, std::string& text) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f.is_open()) return false;
+    std::ostringstream ss;
+    ss << f.rdbuf();
+    text = ss.str();
+    stats::add(stats::FilesOpened);
+    stats::add(stats::BytesRead, text.size());
+    return true;
+}
+
+// fs::copy, counted; returns the number of bytes copied
+static std::uintmax_t copyFile(const fs::path& from, const fs::path& to) {
+    trace::Span span("copy", from.string());
+    fs::copy(from, to, fs::copy_options::overwrite_existing);
+    std::error_code ec;
+    std::uintmax_t size = fs::file_size(to, ec);
+    if (ec) size = 0;
+    stats::add(stats::FilesOpened, 2);
+    stats::add(stats::StatCalls);
+    stats::add(stats::BytesRead, size);
+    stats::add(stats::BytesWritten, size);
+    return size;
+}
+
+// Points the ref file at `id`, replacing it whole so readers never see a torn ref
+static bool writeRef(const fs::path& ref, const std::string& id) {
+    std::error_code ec;
+    fs::create_directories(ref.parent_path(), ec);
+    fs::path tmp = ref.parent_path() / ("." + ref.filename().string() + ".tmp");
+    if (!writeText(tmp, id + "\n")) return false;
+    fs::rename(tmp, ref, ec);
+    return !ec;
+}
+
+// The parent=<id> field that ends commit lines written since branches became refs; false for
+// older lines, whose parent is the line before
+static bool parentField(const std::vector<std::string>& tokens, std::string& parent) {
+    size_t n = (tokens.size() - 3) / 3;
+    if (tokens.size() == 3 + 3 * n || tokens.back().compare(0, 7, "parent=") != 0) return false;
+    parent = tokens.back().substr(7);
+    return true;
+}
+
+// A recorded path without "." or ".." components or doubled slashes: commits of "." used to
+// record /repo/./file, which is the same file as /repo/file
+static std::string normalPath(const std::string& path) {
+    if (path.find("/.") == std::string::npos && path.find("//") == std::string::npos) return path;
+    return fs::path(path).lexically_normal().string();
+}
+
+// Fields of a log line with escapeField undone: "\|" is a '|' inside a field
+static std::vector<std::string> splitFields(const std::string& line) {
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '\\' && i + 1 < line.size() && line[i + 1] == '|') fields.back() += line[++i];
+        else if (line[i] == '|') fields.emplace_back();
+        else fields.back() += line[i];
+    }
+    if (fields.back().empty()) fields.pop_back();
+    return fields;
+}
+
+// A log line that holds a commit: at least five fields as split() counts them, which drops a
+// trailing empty one. The history index, checkpoints and verify all skip anything shorter.
+static bool isCommitLine(const std::string& line) {
+    size_t fields = std::count(line.begin(), line.end(), '|');
+    if (!line.empty() && line.back() != '|') ++fields;
+    return fields >= 5;
+}
+
+// Components of a recorded path below "/"
+static std::vector<std::string> pathComponents(const std::string& path) {
+    std::vector<std::string> parts;
+    for (size_t at = 0; at < path.size();) {
+        size_t end = std::min(path.find('/', at), path.size());
+        if (end > at) parts.push_back(path.substr(at, end - at));
+        at = end + 1;
+    }
+    return parts;
+}
+
+// Adds the time since `start` to a commit phase and restarts the clock
+static void markPhase(CommitProgress* progress, CommitPhase phase, std::chrono::steady_clock::time_point& start) {
+    auto now = std::chrono::steady_clock::now();
+    if (progress)
+        progress->phaseNanos[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    start = now;
+}
+
+// ---- Repository ----
+
+std::shared_ptr<Repository> Repository::open(const fs::path& root) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<Repository>> open;
+    std::string key = fs::weakly_canonical(root).string();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& slot = open[key];
+    auto repo = slot.lock();
+    if (!repo) {
+        repo = std::make_shared<Repository>(key);
+        slot = repo;
+    }
+    return repo;
+}
+
+Repository::Repository(fs::path root) : root_(std::move(root)) {}
+
+bool Repository::contains(const std::string& file) const {
+    trace::Span span("contains", file);
+    stats::add(stats::StatCalls, 2);
+    try {
+        fs::path resolved = fs::weakly_canonical(fs::absolute(file));
+        fs::path repo = fs::weakly_canonical(fs::absolute(root_));
+        auto rel = fs::relative(resolved, repo);
+        return !rel.empty() && rel.string().find("..") == std::string::npos;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool Repository::runHook(const std::string& hookName) const {
+    fs::path hookPath = root_ / hookName;
+    stats::add(stats::StatCalls);
+    if (fs::exists(hookPath) && fs::is_regular_file(hookPath)) {
+        trace::Span span("hook", hookName);
+        pid_t pid = fork();
+        if (pid == 0) {
+            execlp("/bin/bash", "bash", hookPath.c_str(), nullptr);
+            _exit(127);
+        } else if (pid > 0) {
+            int status;
+            waitpid(pid, &status, 0);
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) return true;
+            std::cerr << hookName << " hook failed (exit code " << WEXITSTATUS(status) << ").\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::map<std::string, std::string> Repository::stagingIndex() const {
+    std::map<std::string, std::string> index;
+    for (const auto& line : readLines(root_ / ".staging_index")) {
+        size_t sep = line.find('|');
+        if (sep != std::string::npos) index[line.substr(0, sep)] = line.substr(sep + 1);
+    }
+    return index;
+}
+
+void Repository::saveStagingIndex(const std::map<std::string, std::string>& index) const {
+    if (index.empty()) {
+        std::error_code ec;
+        fs::remove(root_ / ".staging_index", ec);
+        return;
+    }
+    std::string text;
+    for (const auto& [name, source] : index) text += name + "|" + source + "\n";
+    writeText(root_ / ".staging_index", text);
+}
+
+Repository::StageResult Repository::stage(const std::vector<std::string>& paths) {
+    trace::Span span("stage");
+    StageResult result;
+    fs::path stagingDir = root_ / ".staging";
+    if (!fs::exists(stagingDir)) fs::create_directory(stagingDir);
+    auto index = stagingIndex();
+    for (const auto& filePath : paths) {
+        for (const auto& src : collectFiles(filePath)) {
+            if (!contains(src)) {
+                result.rejected.push_back(src);
+                continue;
+            }
+            std::string name = fs::path(src).filename().string();
+            copyFile(src, stagingDir / name);
+            index[name] = src;
+            result.staged.push_back(src);
+        }
+    }
+    saveStagingIndex(index);
+    return result;
+}
+
+std::vector<std::string> Repository::unstage(const std::vector<std::string>& paths) {
+    std::vector<std::string> removed;
+    fs::path stagingDir = root_ / ".staging";
+    auto index = stagingIndex();
+    auto uploads = stagedUploads();
+    size_t uploadCount = uploads.size();
+    for (const auto& filePath : paths) {
+        std::string name = fs::path(filePath).filename().string();
+        bool found = false;
+        fs::path stagedFile = stagingDir / name;
+        if (fs::exists(stagedFile)) {
+            fs::remove(stagedFile);
+            index.erase(name);
+            found = true;
+        }
+        auto kept = std::remove_if(uploads.begin(), uploads.end(), [&](const StagedUpload& u) {
+            return fs::path(u.path).filename() == name;
+        });
+        if (kept != uploads.end()) found = true;
+        uploads.erase(kept, uploads.end());
+        if (found) removed.push_back(filePath);
+    }
+    saveStagingIndex(index);
+    if (uploads.size() != uploadCount) setStagedUploads(uploads);
+    return removed;
+}
+
+std::vector<std::string> Repository::stagedFiles() {
+    std::vector<std::string> staged;
+    fs::path stagingDir = root_ / ".staging";
+    std::error_code ec;
+    if (fs::exists(stagingDir)) {
+        for (const auto& entry : fs::directory_iterator(stagingDir, ec)) {
+            stats::add(stats::StatCalls);
+            if (fs::is_regular_file(entry)) staged.push_back(entry.path().filename().string());
+        }
+    }
+    for (const auto& u : stagedUploads()) staged.push_back(fs::path(u.path).filename().string());
+    return staged;
+}
+
+// Staged uploads, one "path|hash|versionPath" line each in .staging_uploads
+std::vector<StagedUpload> Repository::stagedUploads() const {
+    std::vector<StagedUpload> uploads;
+    for (const auto& line : readLines(root_ / ".staging_uploads")) {
+        std::vector<std::string> tokens = split(line, '|');
+        if (tokens.size() == 3) uploads.push_back({tokens[0], tokens[1], tokens[2]});
+    }
+    return uploads;
+}
+
+void Repository::setStagedUploads(const std::vector<StagedUpload>& uploads) {
+    if (uploads.empty()) {
+        std::error_code ec;
+        fs::remove(root_ / ".staging_uploads", ec);
+        return;
+    }
+    std::string text;
+    for (const auto& u : uploads) text += u.path + "|" + u.hash + "|" + u.versionPath + "\n";
+    writeText(root_ / ".staging_uploads", text);
+}
+
+Repository::CommitResult Repository::commit(const std::vector<std::string>& filePaths, const std::string& message,
+                                            CommitProgress* progress) {
+    trace::Span span("commit");
+    fs::path versionDir = root_ / "versions";
+    if (!fs::exists(versionDir)) throw std::runtime_error("Repository not initialized");
+    if (!runHook(".pre-commit")) throw std::runtime_error("Commit aborted by pre-commit hook");
+
+    // Each source is read from `from` and recorded as `as`; they differ for staged copies
+    struct Source {
+        std::string from;
+        std::string as;
+    };
+    std::vector<Source> sources;
+    std::vector<StagedUpload> uploads;
+    auto phaseStart = std::chrono::steady_clock::now();
+    bool fromStaging = filePaths.empty();
+    if (fromStaging) {
+        auto index = stagingIndex();
+        std::error_code ec;
+        fs::path stagingDir = root_ / ".staging";
+        if (fs::exists(stagingDir)) {
+            for (const auto& entry : fs::directory_iterator(stagingDir, ec)) {
+                if (!fs::is_regular_file(entry)) continue;
+                std::string name = entry.path().filename().string();
+                auto it = index.find(name);
+                // Copies staged before the index existed are recorded under their staging path
+                sources.push_back({entry.path().string(), it != index.end() ? it->second : entry.path().string()});
+            }
+        }
+        uploads = stagedUploads();
+    } else {
+        for (const auto& fp : filePaths)
+            for (const auto& f : collectFiles(fp)) sources.push_back({f, f});
+    }
+    markPhase(progress, PhaseWalk, phaseStart);
+    if (progress) progress->filesTotal = sources.size() + uploads.size();
+
+    std::vector<std::string> ignoredFiles;
+    for (const auto& line : readLines(root_ / ".bypass"))
+        if (!line.empty() && line[0] != '#') ignoredFiles.push_back(line);
+
+    CommitResult result;
+    std::vector<std::string> versionPaths;
+    std::vector<fs::path> stored;
+    std::vector<std::string> storedAs;
+    for (const auto& src : sources) {
+        if (!contains(src.from) || !contains(src.as)) {
+            result.rejected.push_back(src.as);
+            continue;
+        }
+        fs::path file = fs::absolute(src.from);
+        stats::add(stats::StatCalls);
+        if (!fs::exists(file)) {
+            result.missing.push_back(src.as);
+            continue;
+        }
+        if (std::find(ignoredFiles.begin(), ignoredFiles.end(), src.as) != ignoredFiles.end()) {
+            result.ignored.push_back(src.as);
+            continue;
+        }
+        stored.push_back(file);
+        storedAs.push_back(src.as);
+    }
+    markPhase(progress, PhaseWalk, phaseStart);
+    std::vector<std::string> fileHashes = this->fileHashes(stored, progress);
+    markPhase(progress, PhaseHash, phaseStart);
+    // Versions are named by content: two files with one name committed in the same second used
+    // to share a version and overwrite each other, and unchanged content is not stored twice
+    for (size_t i = 0; i < stored.size(); ++i) {
+        if (fileHashes[i].empty()) throw std::runtime_error("Unable to read " + stored[i].string());
+        fs::path versionFilePath = versionPath(fileHashes[i], storedAs[i]);
+        std::error_code ec;
+        stats::add(stats::StatCalls);
+        if (!fs::exists(versionFilePath, ec)) {
+            // Named by content, so an existing one is already right; the rename keeps a reader
+            // from ever seeing one half-written
+            fs::path tmp = versionDir / ("." + versionFilePath.filename().string() + ".tmp");
+            std::uintmax_t size = copyFile(stored[i], tmp);
+            fs::rename(tmp, versionFilePath);
+            if (progress) {
+                progress->bytesStored += size;
+                progress->bytesRead += size;
+            }
+        }
+        versionPaths.push_back(versionFilePath.string());
+        result.files.push_back(fs::absolute(storedAs[i]).lexically_normal().string());
+    }
+    markPhase(progress, PhaseStore, phaseStart);
+    // Uploads are already stored and hashed
+    for (const auto& u : uploads) {
+        result.files.push_back(u.path);
+        fileHashes.push_back(u.hash);
+        versionPaths.push_back(u.versionPath);
+    }
+    if (result.files.empty()) throw std::runtime_error("No valid files to commit");
+
+    std::string ts = timestamp();
+    // The parent is the current branch's tip. Directory branches, and refs left pointing at
+    // commits a pull has replaced, fall back to the end of the log as before refs.
+    fs::path ref = root_ / "branches" / currentBranch();
+    std::error_code ec;
+    bool onRef = !fs::is_directory(ref, ec);
+    std::string parentHash = onRef ? currentCommit() : head();
+    // Commit ID covers the parent for chain integrity
+    std::ostringstream commitContent;
+    commitContent << message << "|" << ts;
+    if (!parentHash.empty()) commitContent << "|parent=" << parentHash;
+    for (size_t i = 0; i < result.files.size(); ++i) commitContent << "|" << result.files[i] << "|" << fileHashes[i];
+    commitContent << "|";
+    for (const auto& vp : versionPaths) commitContent << vp << "|";
+    result.id = hashString(commitContent.str());
+
+    off_t lineStart = 0, lineEnd = 0;
+    {
+        trace::Span appendSpan("logAppend");
+        struct stat st;
+        stats::add(stats::StatCalls);
+        if (stat(logPath().c_str(), &st) == 0) lineStart = st.st_size;
+        std::ostringstream logLine;
+        logLine << result.id << "|" << escapeField(message) << "|" << ts;
+        for (size_t i = 0; i < result.files.size(); ++i) logLine << "|" << escapeField(result.files[i]) << "|" << fileHashes[i];
+        logLine << "|";
+        for (const auto& vp : versionPaths) logLine << vp << "|";
+        logLine << "parent=" << parentHash << "|\n";
+        lineEnd = lineStart + static_cast<off_t>(logLine.str().size());
+        writeText(logPath(), logLine.str(), std::ios::app);
+        if (onRef) writeRef(ref, result.id);
+    }
+    {
+        // The new tree rewrites only the parent tree's directories on the way to these files.
+        // Histories from before trees get theirs built on first use rather than in a commit.
+        trace::Span treeSpan("commitTree");
+        std::lock_guard<std::mutex> lock(treeMutex_);
+        try {
+            std::string parentTree = parentHash.empty() ? "" : recordedTree(parentHash);
+            if (parentHash.empty() || !parentTree.empty()) {
+                std::vector<TreeUpdate> updates;
+                for (size_t i = 0; i < result.files.size(); ++i)
+                    updates.push_back({pathComponents(normalPath(result.files[i])), {false, fileHashes[i], versionPaths[i]}});
+                std::stable_sort(updates.begin(), updates.end(),
+                                 [](const TreeUpdate& a, const TreeUpdate& b) { return a.components < b.components; });
+                std::string tree = updateTree(parentTree, updates.begin(), updates.end(), 0);
+                if (treesLoaded_) commitTrees_[result.id] = tree;
+                fs::create_directories(root_ / ".trees", ec);
+                writeText(root_ / ".trees" / "commits", result.id + "|" + tree + "\n", std::ios::app);
+                addCheckpoint(result.id, lineStart, lineEnd, tree);
+            }
+        } catch (const std::exception&) {
+            // The commit is in the log; its tree is built again when it is first asked for
+        }
+    }
+    markPhase(progress, PhaseLogAppend, phaseStart);
+
+    runHook(".post-commit");
+    if (fromStaging) {
+        std::error_code ec;
+        for (const auto& src : sources) fs::remove(src.from, ec);
+        saveStagingIndex({});
+        if (!uploads.empty()) setStagedUploads({});
+    }
+    return result;
+}
+
+std::string Repository::rollback(const std::string& target, const std::string& commitId) {
+    trace::Span span("rollback", target);
+    if (!contains(target)) throw std::runtime_error("Target " + target + " is outside the repository");
+    std::string wanted = fs::absolute(target).lexically_normal().string();
+    std::string found;
+    size_t n = History::npos;
+    if (commitId.empty()) {
+        found = latestVersion(wanted);
+    } else {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(commitId);
+        if (p == history_.position.end()) throw std::runtime_error("No commit " + commitId);
+        n = p->second;
+    }
+    // As of a commit: from the nearest checkpoint rather than the whole log
+    TreeEntry entry;
+    if (n != History::npos && fileAsOf(wanted, n, entry)) found = entry.version;
+    if (found.empty()) throw std::runtime_error("No matching commit or version found for " + target);
+    copyFile(found, target);
+    return found;
+}
+
+std::vector<std::string> Repository::conflicts() {
+    trace::Span span("conflicts");
+    std::vector<std::string> result;
+    std::string line = currentLogLine();
+    if (line.empty()) return result;
+    std::vector<std::string> tokens = split(line, '|');
+    if (tokens.size() < 6) return result;
+    // Line layout: id|message|timestamp|file1|hash1|...|fileN|hashN|version1|...|versionN|
+    size_t n = (tokens.size() - 3) / 3;
+    for (size_t i = 0; i < n; ++i) {
+        std::string f = fs::path(tokens[3 + 2 * i]).filename().string();
+        std::string versionPath = tokens[3 + 2 * n + i];
+        stats::add(stats::StatCalls);
+        if (!versionPath.empty() && fs::exists(f) && !sameContent(f, versionPath) &&
+            std::find(result.begin(), result.end(), f) == result.end())
+            result.push_back(f);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool Repository::unchanged(const StatEntry& e, const struct stat& st) {
+    return e.dev == st.st_dev && e.ino == st.st_ino && e.size == st.st_size &&
+           e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+// Last line of a file of `size` bytes, without its newline, read backwards from the end
+static std::string readLastLine(const fs::path& path, off_t size) {
+    std::ifstream file(path, std::ios::binary);
+    stats::add(stats::FilesOpened);
+    std::string line;
+    off_t end = size;
+    // Ignore the trailing newline, then collect bytes back to the previous one
+    char c;
+    if (end > 0 && file.seekg(end - 1) && file.get(c) && c == '\n') --end;
+    const off_t block = 4096;
+    off_t pos = end;
+    while (pos > 0) {
+        off_t start = std::max<off_t>(0, pos - block);
+        std::string chunk(pos - start, '\0');
+        file.seekg(start);
+        file.read(&chunk[0], chunk.size());
+        stats::add(stats::BytesRead, chunk.size());
+        size_t nl = chunk.rfind('\n');
+        if (nl != std::string::npos) {
+            line.insert(0, chunk, nl + 1, std::string::npos);
+            break;
+        }
+        line.insert(0, chunk);
+        pos = start;
+    }
+    return line;
+}
+
+// Last line of the commit log, read backwards from the end instead of scanning the whole log.
+// Remembered until the log's size or mtime changes.
+std::string Repository::lastLogLine() {
+    struct stat st;
+    stats::add(stats::StatCalls);
+    if (stat(logPath().c_str(), &st) != 0) return "";
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        if (unchanged(lastLine_, st)) return lastLine_.value;
+    }
+    trace::Span span("lastLogLine");
+    std::string line = readLastLine(logPath(), st.st_size);
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    lastLine_ = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, line};
+    return line;
+}
+
+// Content hash, reused while the file's inode, size and mtime are unchanged
+// Reads only the lines appended since the last call, unless the log was replaced (pull copies
+// the remote's over it) or rewritten, in which case the index starts over
+void Repository::refreshHistory() {
+    History& h = history_;
+    struct stat st;
+    stats::add(stats::StatCalls);
+    if (stat(logPath().c_str(), &st) != 0) {
+        if (h.indexed > 0) ++historyGeneration_;
+        h = History();
+        return;
+    }
+    if (unchanged(h.log, st)) return;
+    trace::Span span("history");
+    std::ifstream logFile(logPath(), std::ios::binary);
+    stats::add(stats::FilesOpened);
+    bool appended = h.indexed > 0 && st.st_size > h.indexed && h.log.dev == st.st_dev && h.log.ino == st.st_ino;
+    if (appended) {
+        std::string expected = h.tail + "\n";
+        std::string found(expected.size(), '\0');
+        logFile.seekg(h.indexed - static_cast<off_t>(expected.size()));
+        logFile.read(&found[0], found.size());
+        stats::add(stats::BytesRead, found.size());
+        appended = logFile && found == expected;
+    }
+    if (!appended) {
+        if (h.indexed > 0) ++historyGeneration_;
+        h = History();
+        logFile.clear();
+    }
+    logFile.seekg(h.indexed);
+    std::string line;
+    // A line without its newline is still being written; it is picked up next time
+    while (std::getline(logFile, line) && !logFile.eof()) {
+        stats::add(stats::BytesRead, line.size() + 1);
+        off_t start = h.indexed;
+        h.indexed += line.size() + 1;
+        h.tail = line;
+        if (!isCommitLine(line)) continue;
+        std::vector<std::string> tokens = split(line, '|');
+        size_t at = h.ids.size();
+        std::string parent;
+        size_t parentPosition = at == 0 ? History::npos : at - 1;
+        if (parentField(tokens, parent)) {
+            auto p = h.position.find(parent);
+            parentPosition = p == h.position.end() ? History::npos : p->second;
+        }
+        h.add(tokens[0], start, parentPosition);
+        // Line layout: id|message|timestamp|file1|hash1|...|fileN|hashN|version1|...|versionN|[parent=<id>|]
+        size_t n = (tokens.size() - 3) / 3;
+        for (size_t i = 0; i < n; ++i) {
+            std::string path = normalPath(tokens[3 + 2 * i]);
+            auto& versions = h.versions[path];
+            if (versions.empty()) h.paths[fs::path(path).filename().string()].push_back(path);
+            versions.push_back({at, tokens[4 + 2 * i], tokens[3 + 2 * n + i]});
+            h.byHash[tokens[4 + 2 * i]] = path;
+        }
+    }
+    h.log = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, ""};
+}
+
+std::string Repository::head() {
+    std::string line = lastLogLine();
+    return line.empty() ? "" : split(line, '|')[0];
+}
+
+std::string Repository::currentCommit() {
+    std::string tip = branchTip(currentBranch());
+    std::string last = head();
+    if (tip.empty() || tip == last) return last;
+    return resolveCommit(tip) == tip ? tip : last;
+}
+
+std::string Repository::currentLogLine() {
+    std::string id = currentCommit();
+    std::string line = lastLogLine();
+    if (id.empty() || line.compare(0, id.size() + 1, id + "|") == 0) return line;
+    // Not at the end of the log
+    return logLineOf(id);
+}
+
+// The line where the index says the commit starts
+std::string Repository::logLineOf(const std::string& id) {
+    off_t offset;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(id);
+        if (p == history_.position.end()) return "";
+        offset = history_.offsets[p->second];
+    }
+    std::string line;
+    std::ifstream logFile(logPath(), std::ios::binary);
+    stats::add(stats::FilesOpened);
+    logFile.seekg(offset);
+    if (!std::getline(logFile, line)) return "";
+    stats::add(stats::BytesRead, line.size() + 1);
+    return line;
+}
+
+std::string Repository::parentOf(const std::string& id) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    auto it = history_.position.find(id);
+    if (it == history_.position.end() || history_.parent[it->second] == History::npos) return "";
+    return history_.ids[history_.parent[it->second]];
+}
+
+std::string Repository::mergeBase(const std::string& a, const std::string& b) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    auto pa = history_.position.find(a);
+    auto pb = history_.position.find(b);
+    if (pa == history_.position.end() || pb == history_.position.end()) return "";
+    size_t base = history_.commonAncestor(pa->second, pb->second);
+    return base == History::npos ? "" : history_.ids[base];
+}
+
+void Repository::History::add(const std::string& id, off_t offset, size_t parentPosition) {
+    size_t at = ids.size();
+    ids.push_back(id);
+    offsets.push_back(offset);
+    parent.push_back(parentPosition);
+    position.emplace(id, at);
+    if (parentPosition == npos) {
+        depth.push_back(0);
+        jump.push_back(at);
+        return;
+    }
+    depth.push_back(depth[parentPosition] + 1);
+    // Myers' skew-binary jump pointers: jump targets depend only on depth, and one pointer per
+    // commit reaches any ancestor in O(log n) hops
+    size_t j = jump[parentPosition];
+    bool even = depth[parentPosition] - depth[j] == depth[j] - depth[jump[j]];
+    jump.push_back(even ? jump[j] : parentPosition);
+}
+
+size_t Repository::History::ancestorAt(size_t c, size_t d) const {
+    while (depth[c] > d) c = depth[jump[c]] >= d ? jump[c] : parent[c];
+    return c;
+}
+
+bool Repository::History::isAncestor(size_t a, size_t c) const {
+    return a != npos && c != npos && depth[a] <= depth[c] && ancestorAt(c, depth[a]) == a;
+}
+
+size_t Repository::History::commonAncestor(size_t a, size_t b) const {
+    if (depth[a] > depth[b]) a = ancestorAt(a, depth[b]);
+    else b = ancestorAt(b, depth[a]);
+    // Same depth from here on, so both jump pointers land at the same depth
+    while (a != b) {
+        if (parent[a] == npos) return npos;
+        if (jump[a] != jump[b]) a = jump[a], b = jump[b];
+        else a = parent[a], b = parent[b];
+    }
+    return a;
+}
+
+const Repository::History::Version* Repository::History::versionAsOf(const std::string& path, size_t c) const {
+    auto v = versions.find(path);
+    if (v == versions.end() || c == npos) return nullptr;
+    // Ancestors come before `c` in the log; on an unbranched history the first candidate is one
+    auto it = std::upper_bound(v->second.begin(), v->second.end(), c,
+                               [](size_t pos, const Version& e) { return pos < e.position; });
+    while (it != v->second.begin()) {
+        --it;
+        if (isAncestor(it->position, c)) return &*it;
+    }
+    return nullptr;
+}
+
+std::string Repository::versionAt(const std::string& name, const std::string& id) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    auto p = history_.position.find(id);
+    auto paths = history_.paths.find(name);
+    if (p == history_.position.end() || paths == history_.paths.end()) return "";
+    // Of the paths with that name, the one committed most recently
+    const History::Version* newest = nullptr;
+    for (const auto& path : paths->second) {
+        const History::Version* v = history_.versionAsOf(path, p->second);
+        if (v && (!newest || v->position > newest->position)) newest = v;
+    }
+    return newest ? newest->path : "";
+}
+
+std::string Repository::resolveCommit(const std::string& idOrPrefix) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    if (idOrPrefix.empty()) return "";
+    if (history_.position.count(idOrPrefix)) return idOrPrefix;
+    std::string found;
+    for (const auto& id : history_.ids) {
+        if (id.compare(0, idOrPrefix.size(), idOrPrefix) != 0 || id == found) continue;
+        if (!found.empty()) return "";
+        found = id;
+    }
+    return found;
+}
+
+bool Repository::versionWithHash(const std::string& hash, std::string& path, TreeEntry& result) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    auto p = history_.byHash.find(hash);
+    if (p == history_.byHash.end()) return false;
+    const auto& versions = history_.versions.at(p->second);
+    for (auto v = versions.rbegin(); v != versions.rend(); ++v) {
+        if (v->hash != hash) continue;
+        path = p->second;
+        result = {false, v->hash, v->path};
+        return true;
+    }
+    return false;
+}
+
+uint64_t Repository::historyGeneration() {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    return historyGeneration_;
+}
+
+std::string Repository::latestVersion(const std::string& path) {
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    auto v = history_.versions.find(normalPath(fs::absolute(path).string()));
+    return v == history_.versions.end() ? "" : v->second.back().path;
+}
+
+// Messages are not indexed: one pass over the log
+std::string Repository::commitWithMessage(const std::string& message) {
+    std::ifstream logFile(logPath(), std::ios::binary);
+    stats::add(stats::FilesOpened);
+    std::string line;
+    while (std::getline(logFile, line)) {
+        stats::add(stats::BytesRead, line.size() + 1);
+        std::vector<std::string> fields = splitFields(line);
+        if (fields.size() >= 5 && fields[1] == message) return fields[0];
+    }
+    return "";
+}
+
+// `filter` absolute: that path or anything under it; relative: a trailing run of path components
+static bool pathMatches(const std::string& recorded, const std::string& filter) {
+    if (filter.empty()) return true;
+    std::string f = filter.back() == '/' ? filter.substr(0, filter.size() - 1) : filter;
+    if (f.empty() || recorded == f) return true;
+    if (f[0] == '/') return recorded.compare(0, f.size() + 1, f + "/") == 0;
+    for (size_t at = recorded.find("/" + f); at != std::string::npos; at = recorded.find("/" + f, at + 1)) {
+        size_t end = at + 1 + f.size();
+        if (end == recorded.size() || recorded[end] == '/') return true;
+    }
+    return false;
+}
+
+// ---- Trees ----
+
+static fs::path treeObjectPath(const fs::path& root, const std::string& hash) {
+    return root / ".trees" / "objects" / hash.substr(0, 2) / hash.substr(2);
+}
+
+std::shared_ptr<const Repository::Tree> Repository::loadTree(const std::string& hash) {
+    auto cached = treeCache_.find(hash);
+    if (cached != treeCache_.end()) return cached->second;
+    fs::path file = treeObjectPath(root_, hash);
+    std::error_code ec;
+    stats::add(stats::StatCalls);
+    if (!fs::exists(file, ec)) throw std::runtime_error("Tree object missing: " + hash);
+    auto tree = std::make_shared<Tree>();
+    for (const auto& line : readLines(file)) {
+        std::vector<std::string> fields = split(line, '|');
+        if (fields.size() == 4 && fields[0] == "f") (*tree)[fields[3]] = {false, fields[1], fields[2]};
+        else if (fields.size() == 3 && fields[0] == "d") (*tree)[fields[2]] = {true, fields[1], ""};
+    }
+    // Recent commits' directories are the ones asked for again; the rest are read back from disk
+    if (treeCache_.size() >= 16384) treeCache_.clear();
+    treeCache_.emplace(hash, tree);
+    return tree;
+}
+
+std::string Repository::storeTree(const Tree& tree) {
+    std::string text;
+    for (const auto& [name, entry] : tree) {
+        if (entry.directory) text += "d|" + entry.hash + "|" + name + "\n";
+        else text += "f|" + entry.hash + "|" + entry.version + "|" + name + "\n";
+    }
+    std::string hash = hashString(text);
+    if (treeCache_.count(hash)) return hash;
+    fs::path file = treeObjectPath(root_, hash);
+    std::error_code ec;
+    stats::add(stats::StatCalls);
+    if (!fs::exists(file, ec)) {
+        // Named by content, so an existing object is already right; the rename keeps a reader
+        // from ever seeing one half-written
+        fs::create_directories(file.parent_path(), ec);
+        fs::path tmp = file.string() + ".tmp";
+        if (writeText(tmp, text)) fs::rename(tmp, file, ec);
+    }
+    if (treeCache_.size() >= 16384) treeCache_.clear();
+    treeCache_.emplace(hash, std::make_shared<Tree>(tree));
+    return hash;
+}
+
+std::string Repository::updateTree(const std::string& base, std::vector<TreeUpdate>::const_iterator begin,
+                                   std::vector<TreeUpdate>::const_iterator end, size_t depth) {
+    Tree tree;
+    if (!base.empty()) tree = *loadTree(base);
+    for (auto it = begin; it != end;) {
+        const std::string& name = it->components[depth];
+        auto group = std::find_if(it, end, [&](const TreeUpdate& u) { return u.components[depth] != name; });
+        // Sorted, so a file recorded at this level comes before paths below a directory of that name
+        for (; it != group && it->components.size() == depth + 1; ++it) tree[name] = it->file;
+        if (it != group) {
+            auto existing = tree.find(name);
+            std::string subtree = existing != tree.end() && existing->second.directory ? existing->second.hash : "";
+            tree[name] = {true, updateTree(subtree, it, group, depth + 1), ""};
+        }
+        it = group;
+    }
+    return storeTree(tree);
+}
+
+bool Repository::hasTree(const std::string& id) {
+    if (!treesLoaded_) {
+        // id|tree
+        for (const auto& line : readLines(root_ / ".trees" / "commits")) {
+            size_t bar = line.find('|');
+            if (bar != std::string::npos && line.size() - bar - 1 == 64) commitTrees_[line.substr(0, bar)] = line.substr(bar + 1);
+        }
+        treesLoaded_ = true;
+    }
+    return commitTrees_.count(id) > 0;
+}
+
+std::string Repository::recordedTree(const std::string& id) {
+    if (!treesLoaded_) {
+        fs::path index = root_ / ".trees" / "commits";
+        struct stat st;
+        stats::add(stats::StatCalls);
+        if (stat(index.c_str(), &st) != 0) return "";
+        std::string last = readLastLine(index, st.st_size);
+        if (last.size() == id.size() + 65 && last.compare(0, id.size() + 1, id + "|") == 0) return last.substr(id.size() + 1);
+    }
+    return hasTree(id) ? commitTrees_[id] : "";
+}
+
+std::string Repository::treeOfLocked(const std::string& id) {
+    if (hasTree(id)) return commitTrees_[id];
+    // The commit and its ancestors back to the nearest one with a tree, newest first
+    std::vector<std::pair<std::string, off_t>> pending;
+    std::string tree;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(id);
+        if (p == history_.position.end()) throw std::runtime_error("Unknown commit " + id);
+        for (size_t c = p->second; c != History::npos; c = history_.parent[c]) {
+            auto known = commitTrees_.find(history_.ids[c]);
+            if (known != commitTrees_.end()) {
+                tree = known->second;
+                break;
+            }
+            pending.emplace_back(history_.ids[c], history_.offsets[c]);
+        }
+    }
+    trace::Span span("buildTrees", id);
+    fs::path index = root_ / ".trees" / "commits";
+    std::error_code ec;
+    fs::create_directories(index.parent_path(), ec);
+    std::ifstream logFile(logPath(), std::ios::binary);
+    stats::add(stats::FilesOpened);
+    std::string line, appended;
+    for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+        logFile.seekg(it->second);
+        if (!std::getline(logFile, line) || line.compare(0, it->first.size() + 1, it->first + "|") != 0)
+            throw std::runtime_error("Commit log changed while building trees");
+        stats::add(stats::BytesRead, line.size() + 1);
+        std::vector<std::string> tokens = split(line, '|');
+        size_t n = (tokens.size() - 3) / 3;
+        std::vector<TreeUpdate> updates;
+        for (size_t i = 0; i < n; ++i) {
+            updates.push_back({pathComponents(normalPath(tokens[3 + 2 * i])),
+                               {false, tokens[4 + 2 * i], tokens[3 + 2 * n + i]}});
+        }
+        std::stable_sort(updates.begin(), updates.end(),
+                         [](const TreeUpdate& a, const TreeUpdate& b) { return a.components < b.components; });
+        tree = updateTree(tree, updates.begin(), updates.end(), 0);
+        commitTrees_[it->first] = tree;
+        appended += it->first + "|" + tree + "\n";
+        // A long first build keeps what it has done if it is interrupted
+        if (appended.size() >= 65536) {
+            writeText(index, appended, std::ios::app);
+            appended.clear();
+        }
+    }
+    if (!appended.empty()) writeText(index, appended, std::ios::app);
+    return tree;
+}
+
+std::string Repository::treeOf(const std::string& id) {
+    std::lock_guard<std::mutex> lock(treeMutex_);
+    return treeOfLocked(id);
+}
+
+Repository::Tree Repository::listTree(const std::string& id, const std::string& dir) {
+    trace::Span span("listTree", dir);
+    std::lock_guard<std::mutex> lock(treeMutex_);
+    std::string hash = treeOfLocked(id);
+    for (const auto& name : pathComponents(normalPath(dir))) {
+        auto tree = loadTree(hash);
+        auto entry = tree->find(name);
+        if (entry == tree->end() || !entry->second.directory)
+            throw std::runtime_error(dir + " is not a directory in commit " + id);
+        hash = entry->second.hash;
+    }
+    return *loadTree(hash);
+}
+
+Repository::Tree Repository::committedFiles(const std::string& id) {
+    Tree result;
+    std::vector<std::string> fields = splitFields(logLineOf(id));
+    if (fields.size() < 5) return result;
+    // Line layout: id|message|timestamp|file1|hash1|...|fileN|hashN|version1|...|versionN|[parent=<id>|]
+    size_t n = (fields.size() - 3) / 3;
+    for (size_t i = 0; i < n; ++i)
+        result[normalPath(fields[3 + 2 * i])] = {false, fields[4 + 2 * i], fields[3 + 2 * n + i]};
+    return result;
+}
+
+// position|id|offset|tree
+static bool parseCheckpoint(const std::string& line, size_t& position, std::string& id, off_t& offset,
+                            std::string& tree) {
+    std::vector<std::string> fields = split(line, '|');
+    if (fields.size() != 4 || fields[1].empty() || fields[3].size() != 64) return false;
+    char* end = nullptr;
+    position = std::strtoull(fields[0].c_str(), &end, 10);
+    if (*end != '\0') return false;
+    offset = std::strtoll(fields[2].c_str(), &end, 10);
+    if (*end != '\0') return false;
+    id = fields[1];
+    tree = fields[3];
+    return true;
+}
+
+// The log line at `offset` belongs to commit `id`: a checkpoint still fits the log
+static bool lineStartsWith(std::ifstream& log, off_t offset, const std::string& id) {
+    std::string prefix(id.size() + 1, '\0');
+    log.clear();
+    log.seekg(offset);
+    log.read(&prefix[0], prefix.size());
+    stats::add(stats::BytesRead, prefix.size());
+    return log && prefix == id + "|";
+}
+
+size_t Repository::checkpointInterval() const {
+    std::ifstream in(root_ / ".checkpoint_interval");
+    size_t interval = 1000;
+    if (in) in >> interval;
+    return interval;
+}
+
+void Repository::addCheckpoint(const std::string& id, off_t offset, off_t end, const std::string& tree) {
+    size_t interval = checkpointInterval();
+    if (interval == 0) return;
+    std::ifstream logFile(logPath(), std::ios::binary);
+    stats::add(stats::FilesOpened);
+    // This commit's position: one past the one .checkpoints.tail recorded for the previous commit
+    // when that line ends where this one starts, otherwise the history index's
+    fs::path tailFile = root_ / ".checkpoints.tail";
+    auto tail = readLines(tailFile);
+    std::vector<std::string> fields = split(tail.empty() ? "" : tail[0], '|');
+    size_t position = History::npos;
+    if (fields.size() == 4 && fields[3] == std::to_string(offset) &&
+        lineStartsWith(logFile, std::strtoll(fields[2].c_str(), nullptr, 10), fields[1])) {
+        position = std::strtoull(fields[0].c_str(), nullptr, 10) + 1;
+    } else {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(id);
+        if (p == history_.position.end()) return;
+        position = p->second;
+    }
+    writeText(tailFile, std::to_string(position) + "|" + id + "|" + std::to_string(offset) + "|" +
+                            std::to_string(end) + "\n");
+
+    fs::path file = root_ / ".checkpoints";
+    struct stat st;
+    stats::add(stats::StatCalls);
+    std::string last = stat(file.c_str(), &st) == 0 ? readLastLine(file, st.st_size) : "";
+    Checkpoint from;
+    // No checkpoint yet, or a pull replaced the log under them: one pass over the log sets them up
+    if (!parseCheckpoint(last, from.position, from.id, from.offset, from.tree) || from.position >= position ||
+        !lineStartsWith(logFile, from.offset, from.id)) {
+        rebuildCheckpointsLocked();
+        return;
+    }
+    if (position - from.position < interval) return;
+    writeText(file, std::to_string(position) + "|" + id + "|" + std::to_string(offset) + "|" + tree + "\n",
+              std::ios::app);
+}
+
+void Repository::rebuildCheckpointsLocked() {
+    trace::Span span("rebuildCheckpoints");
+    size_t interval = checkpointInterval();
+    std::vector<Checkpoint> points;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        for (size_t c = 0; interval > 0 && c < history_.ids.size(); c += interval)
+            points.push_back({c, history_.ids[c], history_.offsets[c], ""});
+    }
+    std::string text;
+    for (auto& point : points) {
+        point.tree = treeOfLocked(point.id);
+        text += std::to_string(point.position) + "|" + point.id + "|" + std::to_string(point.offset) + "|" +
+                point.tree + "\n";
+    }
+    fs::path file = root_ / ".checkpoints";
+    fs::path tmp = file.string() + ".tmp";
+    std::error_code ec;
+    if (writeText(tmp, text)) fs::rename(tmp, file, ec);
+}
+
+void Repository::rebuildCheckpoints() {
+    std::lock_guard<std::mutex> lock(treeMutex_);
+    rebuildCheckpointsLocked();
+}
+
+bool Repository::fileAsOf(const std::string& path, size_t n, TreeEntry& result) {
+    trace::Span span("fileAsOf", path);
+    std::string wanted = normalPath(path);
+    {
+        std::unique_lock<std::mutex> lock(treeMutex_);
+        // Nearest checkpoint at or before n
+        Checkpoint from;
+        bool found = false;
+        for (const auto& line : readLines(root_ / ".checkpoints")) {
+            Checkpoint point;
+            if (!parseCheckpoint(line, point.position, point.id, point.offset, point.tree)) continue;
+            if (point.position > n) break;
+            from = point;
+            found = true;
+        }
+        std::ifstream logFile(logPath(), std::ios::binary);
+        stats::add(stats::FilesOpened);
+        if (found && lineStartsWith(logFile, from.offset, from.id)) {
+            // The commits after the checkpoint through n, keeping of each only its parent and
+            // whether it recorded the path
+            struct Step {
+                std::string id, parent;
+                bool recorded = false;
+                TreeEntry file;
+            };
+            std::vector<Step> steps;
+            std::unordered_map<std::string, size_t> at;
+            logFile.clear();
+            logFile.seekg(from.offset);
+            std::string line, previous;
+            size_t position = from.position;
+            while (position < n + 1 && std::getline(logFile, line) && !logFile.eof()) {
+                stats::add(stats::BytesRead, line.size() + 1);
+                if (!isCommitLine(line)) continue;
+                std::vector<std::string> tokens = split(line, '|');
+                if (position++ == from.position) {
+                    previous = tokens[0];
+                    continue;
+                }
+                Step step{tokens[0], previous, false, {}};
+                parentField(tokens, step.parent);
+                size_t count = (tokens.size() - 3) / 3;
+                for (size_t i = 0; i < count; ++i) {
+                    if (normalPath(tokens[3 + 2 * i]) != wanted) continue;
+                    step.recorded = true;
+                    step.file = {false, tokens[4 + 2 * i], tokens[3 + 2 * count + i]};
+                }
+                previous = step.id;
+                at[step.id] = steps.size();
+                steps.push_back(std::move(step));
+            }
+            if (position <= n) throw std::runtime_error("No commit " + std::to_string(n) + " in the log");
+            // Up n's parent chain to the checkpoint; a chain that leaves the window forked off
+            // before it, so the index answers
+            bool reached = steps.empty();
+            for (size_t i = steps.empty() ? 0 : steps.size() - 1; !steps.empty();) {
+                if (steps[i].recorded) {
+                    result = steps[i].file;
+                    return true;
+                }
+                if (steps[i].parent.empty()) return false;
+                if (steps[i].parent == from.id) {
+                    reached = true;
+                    break;
+                }
+                auto p = at.find(steps[i].parent);
+                if (p == at.end() || p->second >= i) break;
+                i = p->second;
+            }
+            if (reached) {
+                std::string hash = from.tree;
+                std::vector<std::string> components = pathComponents(wanted);
+                for (size_t d = 0; d < components.size(); ++d) {
+                    auto tree = loadTree(hash);
+                    auto entry = tree->find(components[d]);
+                    if (entry == tree->end() || entry->second.directory != (d + 1 < components.size())) return false;
+                    if (!entry->second.directory) {
+                        result = entry->second;
+                        return true;
+                    }
+                    hash = entry->second.hash;
+                }
+                return false;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(historyMutex_);
+    refreshHistory();
+    if (n >= history_.ids.size()) throw std::runtime_error("No commit " + std::to_string(n) + " in the log");
+    const History::Version* version = history_.versionAsOf(wanted, n);
+    if (!version) return false;
+    result = {false, version->hash, version->path};
+    return true;
+}
+
+bool Repository::fileAt(const std::string& id, const std::string& path, TreeEntry& result) {
+    size_t n;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(id);
+        if (p == history_.position.end()) return false;
+        n = p->second;
+    }
+    fs::path wanted = fs::path(path).is_absolute() ? fs::path(path) : root_ / path;
+    return fileAsOf(wanted.lexically_normal().string(), n, result);
+}
+
+// First 16 hex digits of a commit ID, as a number
+static uint64_t idKey(const std::string& id) {
+    return std::strtoull(id.substr(0, 16).c_str(), nullptr, 16);
+}
+
+Repository::Verification Repository::verify(bool full, VerifyProgress* progress) {
+    trace::Span span("verify");
+    Verification result;
+    std::ifstream logFile(logPath(), std::ios::binary);
+    if (!logFile.is_open()) throw std::runtime_error("Commit log file not found");
+    stats::add(stats::FilesOpened);
+    struct stat st;
+    stats::add(stats::StatCalls);
+    off_t size = stat(logPath().c_str(), &st) == 0 ? st.st_size : 0;
+
+    // offset|id|commits of the last commit verified with nothing wrong up to it
+    fs::path marker = root_ / ".verified";
+    std::unordered_set<uint64_t> seen;
+    std::string previous, line;
+    off_t offset = 0;
+    std::string last;
+    readText(marker, last);
+    std::vector<std::string> fields = split(last, '|');
+    if (!full && fields.size() == 3 && lineStartsWith(logFile, std::strtoll(fields[0].c_str(), nullptr, 10), fields[1])) {
+        // The IDs before it are still needed to check that parents come earlier
+        off_t end = std::strtoll(fields[0].c_str(), nullptr, 10);
+        logFile.clear();
+        logFile.seekg(0);
+        while (offset <= end && std::getline(logFile, line)) {
+            stats::add(stats::BytesRead, line.size() + 1);
+            offset += line.size() + 1;
+            if (isCommitLine(line)) seen.insert(idKey(line.substr(0, line.find('|'))));
+        }
+        previous = fields[1];
+        result.earlier = std::strtoull(fields[2].c_str(), nullptr, 10);
+    } else {
+        logFile.clear();
+        logFile.seekg(0);
+    }
+    if (progress) progress->bytesTotal = size - offset;
+
+    struct Commit {
+        off_t offset = 0;
+        std::string line;
+        std::string id, parent;
+        std::vector<std::string> fields;
+        size_t files = 0;
+        std::vector<std::string> problems;
+    };
+    struct Version {
+        size_t commit;
+        size_t file;
+        std::string problem;
+    };
+    size_t verified = result.earlier;
+    bool clean = true;
+    auto report = [&](const std::string& id, const std::string& what) {
+        clean = false;
+        if (result.problemCount++ < 1000) result.problems.push_back(id + ": " + what);
+    };
+    while (true) {
+        std::vector<Commit> batch;
+        size_t bytes = 0;
+        // A line without its newline is still being written; the next run gets it
+        while (batch.size() < 256 && bytes < (64u << 20) && std::getline(logFile, line) && !logFile.eof()) {
+            stats::add(stats::BytesRead, line.size() + 1);
+            off_t at = offset;
+            offset += line.size() + 1;
+            bytes += line.size() + 1;
+            if (progress) progress->bytesDone += line.size() + 1;
+            if (line.empty()) continue;
+            batch.emplace_back();
+            batch.back().offset = at;
+            batch.back().line = std::move(line);
+        }
+        if (batch.empty()) break;
+
+        parallelFor(batch.size(), 8, [&](size_t i) {
+            Commit& c = batch[i];
+            c.fields = splitFields(c.line);
+            c.id = c.fields.empty() ? "" : c.fields[0];
+            if (c.fields.size() < 5) c.problems.push_back("not a commit line");
+            else c.files = (c.fields.size() - 3) / 3;
+        });
+        // Parents in log order: a line without a parent field follows the line before it
+        for (auto& c : batch) {
+            if (c.fields.size() < 5) continue;
+            c.parent = previous;
+            if (c.fields.size() != 3 + 3 * c.files && c.fields.back().compare(0, 7, "parent=") == 0) {
+                c.parent = c.fields.back().substr(7);
+                if (!c.parent.empty() && !seen.count(idKey(c.parent)))
+                    c.problems.push_back("parent " + c.parent + " is not an earlier commit");
+            }
+            if (!seen.insert(idKey(c.id)).second) c.problems.push_back("appears earlier in the log");
+            previous = c.id;
+        }
+        std::vector<Version> versions;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            for (size_t f = 0; f < batch[i].files; ++f) versions.push_back({i, f, ""});
+        }
+        parallelFor(batch.size(), 8, [&](size_t i) {
+            Commit& c = batch[i];
+            if (c.fields.size() < 5) return;
+            std::string content = c.fields[1] + "|" + c.fields[2];
+            if (!c.parent.empty()) content += "|parent=" + c.parent;
+            for (size_t f = 0; f < c.files; ++f) content += "|" + c.fields[3 + 2 * f] + "|" + c.fields[4 + 2 * f];
+            content += "|";
+            for (size_t f = 0; f < c.files; ++f) content += c.fields[3 + 2 * c.files + f] + "|";
+            if (hashString(content) != c.id) c.problems.insert(c.problems.begin(), "ID does not match the commit's content");
+        });
+        parallelFor(versions.size(), 4, [&](size_t v) {
+            const Commit& c = batch[versions[v].commit];
+            size_t f = versions[v].file;
+            const std::string& stored = c.fields[3 + 2 * c.files + f];
+            std::string hash = hashFile(stored);
+            if (hash.empty()) versions[v].problem = "version " + stored + " is missing";
+            else if (hash != c.fields[4 + 2 * f])
+                versions[v].problem = "version " + stored + " does not match the hash recorded for " + c.fields[3 + 2 * f];
+            if (progress) ++progress->versions;
+        });
+        result.versions += versions.size();
+
+        size_t next = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const Commit& c = batch[i];
+            for (const auto& problem : c.problems) report(c.id, problem);
+            for (; next < versions.size() && versions[next].commit == i; ++next) {
+                if (!versions[next].problem.empty()) report(c.id, versions[next].problem);
+            }
+            if (c.fields.size() < 5) continue;
+            ++result.commits;
+            if (progress) ++progress->commits;
+            if (clean) {
+                ++verified;
+                line = std::to_string(c.offset) + "|" + c.id + "|" + std::to_string(verified);
+            }
+        }
+        // Later runs start after the last commit before the first problem
+        if (!line.empty()) {
+            fs::path tmp = marker.string() + ".tmp";
+            std::error_code ec;
+            if (writeText(tmp, line)) fs::rename(tmp, marker, ec);
+        }
+        line.clear();
+    }
+    return result;
+}
+
+void Repository::diffTrees(const std::string& a, const std::string& b, const std::string& dir,
+                           const std::string& filter, std::vector<FileChange>& result) {
+    if (a == b) return;
+    // An absolute filter needs only the directories on the way to it and those under it
+    if (!filter.empty() && filter[0] == '/' && !dir.empty() && !pathMatches(dir, filter) &&
+        filter.compare(0, dir.size() + 1, dir + "/") != 0)
+        return;
+    static const Tree none;
+    std::shared_ptr<const Tree> treeA = a.empty() ? nullptr : loadTree(a);
+    std::shared_ptr<const Tree> treeB = b.empty() ? nullptr : loadTree(b);
+    const Tree& x = treeA ? *treeA : none;
+    const Tree& y = treeB ? *treeB : none;
+    for (auto ia = x.begin(), ib = y.begin(); ia != x.end() || ib != y.end();) {
+        int order = ia == x.end() ? 1 : ib == y.end() ? -1 : ia->first.compare(ib->first);
+        const TreeEntry* ea = order <= 0 ? &ia->second : nullptr;
+        const TreeEntry* eb = order >= 0 ? &ib->second : nullptr;
+        std::string path = dir + "/" + (order <= 0 ? ia->first : ib->first);
+        std::string subA = ea && ea->directory ? ea->hash : "";
+        std::string subB = eb && eb->directory ? eb->hash : "";
+        if (!subA.empty() || !subB.empty()) diffTrees(subA, subB, path, filter, result);
+        const TreeEntry* fileA = ea && !ea->directory ? ea : nullptr;
+        const TreeEntry* fileB = eb && !eb->directory ? eb : nullptr;
+        if ((fileA || fileB) && (!fileA || !fileB || fileA->hash != fileB->hash) && pathMatches(path, filter)) {
+            FileChange change{};
+            change.path = path;
+            if (fileA) change.oldHash = fileA->hash, change.oldVersion = fileA->version;
+            if (fileB) change.newHash = fileB->hash, change.newVersion = fileB->version;
+            result.push_back(std::move(change));
+        }
+        if (order <= 0) ++ia;
+        if (order >= 0) ++ib;
+    }
+}
+
+std::vector<Repository::FileChange> Repository::changes(const std::string& from, const std::string& to,
+                                                        const std::string& path) {
+    trace::Span span("changes");
+    std::lock_guard<std::mutex> lock(treeMutex_);
+    std::string a = from.empty() ? "" : treeOfLocked(from);
+    std::string b = treeOfLocked(to);
+    std::string filter = path;
+    while (filter.size() > 1 && filter.back() == '/') filter.pop_back();
+    std::vector<FileChange> result;
+    diffTrees(a, b, "", filter, result);
+    return result;
+}
+
+static bool isBinary(const std::string& text) {
+    return std::memchr(text.data(), '\0', std::min<size_t>(text.size(), 8000)) != nullptr;
+}
+
+std::string Repository::diff(const FileChange& change) {
+    trace::Span span("diff", change.path);
+    std::string oldText, newText;
+    for (const auto* version : {&change.oldVersion, &change.newVersion}) {
+        if (!version->empty() && !readText(*version, version == &change.oldVersion ? oldText : newText))
+            return "Stored version missing: " + *version + "\n";
+    }
+    std::string oldName = change.oldVersion.empty() ? "/dev/null" : "a" + change.path;
+    std::string newName = change.newVersion.empty() ? "/dev/null" : "b" + change.path;
+    if (isBinary(oldText) || isBinary(newText)) return "Binary files " + oldName + " and " + newName + " differ\n";
+    return unifiedDiff(oldName, oldText, newName, newText);
+}
+
+Repository::DiffStat Repository::diffStat(const std::string& id) {
+    fs::path cachePath = root_ / ".diffstats";
+    {
+        std::lock_guard<std::mutex> lock(diffStatMutex_);
+        if (!diffStatsLoaded_) {
+            // id|files|added|removed
+            for (const auto& line : readLines(cachePath)) {
+                std::vector<std::string> tokens = split(line, '|');
+                if (tokens.size() != 4) continue;
+                try {
+                    diffStats_[tokens[0]] = {std::stoul(tokens[1]), std::stoul(tokens[2]), std::stoul(tokens[3])};
+                } catch (const std::exception&) {
+                    // A torn line from an interrupted write; it is recomputed on demand
+                }
+            }
+            diffStatsLoaded_ = true;
+        }
+        auto it = diffStats_.find(id);
+        if (it != diffStats_.end()) return it->second;
+    }
+    trace::Span span("diffStat", id);
+    DiffStat stat;
+    for (const auto& change : changes(parentOf(id), id)) {
+        ++stat.files;
+        std::string oldText, newText;
+        if (!change.oldVersion.empty()) readText(change.oldVersion, oldText);
+        if (!change.newVersion.empty()) readText(change.newVersion, newText);
+        if (isBinary(oldText) || isBinary(newText)) continue;
+        for (const auto& chunk : diffLines(splitLines(oldText), splitLines(newText))) {
+            stat.added += chunk.bCount;
+            stat.removed += chunk.aCount;
+        }
+    }
+    std::lock_guard<std::mutex> lock(diffStatMutex_);
+    if (diffStats_.emplace(id, stat).second) {
+        writeText(cachePath, id + "|" + std::to_string(stat.files) + "|" + std::to_string(stat.added) + "|" +
+                                 std::to_string(stat.removed) + "\n", std::ios::app);
+    }
+    return stat;
+}
+
+// .blame/<hash of path and commit>: the commits referenced, one per line, a blank line, then the
+// index of each text line's commit, one per line
+static fs::path blameCachePath(const fs::path& root, const std::string& path, const std::string& commit) {
+    return root / ".blame" / hashString(path + "|" + commit);
+}
+
+static bool loadBlame(const fs::path& file, std::vector<std::string>& commits) {
+    std::error_code ec;
+    if (!fs::exists(file, ec)) return false;
+    std::vector<std::string> lines = readLines(file);
+    auto blank = std::find(lines.begin(), lines.end(), "");
+    if (blank == lines.end()) return false;
+    std::vector<std::string> ids(lines.begin(), blank);
+    commits.clear();
+    for (auto it = blank + 1; it != lines.end(); ++it) {
+        size_t index = std::strtoul(it->c_str(), nullptr, 10);
+        if (index >= ids.size()) return false;
+        commits.push_back(ids[index]);
+    }
+    return true;
+}
+
+static void saveBlame(const fs::path& file, const std::vector<std::string>& commits) {
+    std::unordered_map<std::string, size_t> index;
+    std::string head, body;
+    for (const auto& c : commits) {
+        auto it = index.emplace(c, index.size());
+        if (it.second) head += c + "\n";
+        body += std::to_string(it.first->second) + "\n";
+    }
+    std::error_code ec;
+    fs::create_directories(file.parent_path(), ec);
+    fs::path tmp = file.string() + ".tmp";
+    if (writeText(tmp, head + "\n" + body)) fs::rename(tmp, file, ec);
+}
+
+Repository::Blame Repository::blame(const std::string& path, const std::string& at) {
+    trace::Span span("blame", path);
+    Blame result;
+    struct Step {
+        std::string commit, hash, version;
+    };
+    std::vector<Step> chain;
+    std::string tip = at.empty() ? branchTip(currentBranch()) : at;
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        result.path = path;
+        if (!history_.versions.count(path)) {
+            result.path.clear();
+            for (const auto& [recorded, versions] : history_.versions) {
+                if (!pathMatches(recorded, path)) continue;
+                if (!result.path.empty()) throw std::runtime_error(path + " matches more than one committed path");
+                result.path = recorded;
+            }
+            if (result.path.empty()) throw std::runtime_error(path + " was never committed");
+        }
+        auto p = history_.position.find(tip);
+        if (p == history_.position.end()) throw std::runtime_error("Unknown commit " + tip);
+        for (const auto& v : history_.versions[result.path]) {
+            if (history_.isAncestor(v.position, p->second)) chain.push_back({history_.ids[v.position], v.hash, v.path});
+        }
+        if (chain.empty()) throw std::runtime_error(path + " was not committed as of " + tip);
+    }
+    result.commit = chain.back().commit;
+
+    std::string text;
+    if (!readText(chain.back().version, text)) throw std::runtime_error("Stored version missing: " + chain.back().version);
+    std::vector<std::string_view> current = splitLines(text);
+    std::vector<std::string> commits;
+    fs::path cache = blameCachePath(root_, result.path, result.commit);
+    if (!loadBlame(cache, commits) || commits.size() != current.size()) {
+        // Resume from the newest version blamed before, else start with every line from the first
+        size_t from = chain.size() - 1;
+        while (from > 0 && !loadBlame(blameCachePath(root_, result.path, chain[from - 1].commit), commits)) --from;
+        std::string previous;
+        if (from > 0) readText(chain[from - 1].version, previous);
+        if (from == 0 || commits.size() != splitLines(previous).size()) {
+            readText(chain[0].version, previous);
+            commits.assign(splitLines(previous).size(), chain[0].commit);
+            from = 1;
+        }
+        for (size_t k = from; k < chain.size(); ++k) {
+            std::string next;
+            readText(chain[k].version, next);
+            if (chain[k].hash != chain[k - 1].hash) {
+                auto a = splitLines(previous), b = splitLines(next);
+                std::vector<std::string> carried;
+                carried.reserve(b.size());
+                size_t ai = 0;
+                for (const auto& c : diffLines(a, b)) {
+                    carried.insert(carried.end(), commits.begin() + ai, commits.begin() + c.aStart);
+                    carried.insert(carried.end(), c.bCount, chain[k].commit);
+                    ai = c.aStart + c.aCount;
+                }
+                carried.insert(carried.end(), commits.begin() + ai, commits.end());
+                commits = std::move(carried);
+            }
+            previous = std::move(next);
+        }
+        saveBlame(cache, commits);
+    }
+    for (size_t i = 0; i < current.size(); ++i) {
+        std::string_view line = current[i];
+        if (!line.empty() && line.back() == '\n') line.remove_suffix(1);
+        result.lines.push_back({i < commits.size() ? commits[i] : result.commit, std::string(line)});
+    }
+    return result;
+}
+
+std::string Repository::fileHash(const fs::path& file) {
+    struct stat st;
+    stats::add(stats::StatCalls);
+    if (stat(file.c_str(), &st) != 0) return "";
+    std::string key = fs::absolute(file).string();
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        auto it = hashes_.find(key);
+        if (it != hashes_.end() && unchanged(it->second, st)) return it->second.value;
+    }
+    std::string hash = hashFile(file);
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    hashes_[key] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, hash};
+    return hash;
+}
+
+std::vector<std::string> Repository::fileHashes(const std::vector<fs::path>& files, CommitProgress* progress) {
+    std::vector<std::string> hashes(files.size());
+    std::vector<struct stat> stats(files.size());
+    std::vector<std::string> keys(files.size());
+    std::vector<fs::path> missing;
+    std::vector<size_t> missingIndex;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        for (size_t i = 0; i < files.size(); ++i) {
+            stats::add(stats::StatCalls);
+            if (stat(files[i].c_str(), &stats[i]) != 0) continue;
+            keys[i] = fs::absolute(files[i]).string();
+            auto it = hashes_.find(keys[i]);
+            if (it != hashes_.end() && unchanged(it->second, stats[i])) {
+                hashes[i] = it->second.value;
+                if (progress) ++progress->filesHashed;
+            } else {
+                missing.push_back(files[i]);
+                missingIndex.push_back(i);
+            }
+        }
+    }
+    auto computed = hashFiles(missing, [&](size_t m) {
+        if (!progress) return;
+        progress->bytesRead += stats[missingIndex[m]].st_size;
+        ++progress->filesHashed;
+    });
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    for (size_t m = 0; m < missing.size(); ++m) {
+        size_t i = missingIndex[m];
+        const struct stat& st = stats[i];
+        hashes[i] = computed[m];
+        hashes_[keys[i]] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, computed[m]};
+    }
+    return hashes;
+}
+
+bool Repository::sameContent(const fs::path& a, const fs::path& b) {
+    std::error_code ec1, ec2;
+    auto sizeA = fs::file_size(a, ec1);
+    auto sizeB = fs::file_size(b, ec2);
+    stats::add(stats::StatCalls, 2);
+    if (ec1 || ec2 || sizeA != sizeB) return false;
+    std::string hashA = fileHash(a);
+    return !hashA.empty() && hashA == fileHash(b);
+}
+
+std::vector<std::string> Repository::branches() const {
+    std::vector<std::string> result;
+    fs::path branchesPath = root_ / "branches";
+    std::error_code ec;
+    if (fs::exists(branchesPath)) {
+        // Ref files and directory branches; dotfiles are refs being replaced
+        for (const auto& entry : fs::directory_iterator(branchesPath, ec)) {
+            std::string name = entry.path().filename().string();
+            if (name[0] != '.' && (entry.is_regular_file(ec) || entry.is_directory(ec))) result.push_back(name);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::string Repository::currentBranch() const {
+    auto lines = readLines(root_ / ".current_branch");
+    return lines.empty() || lines[0].empty() ? "main" : lines[0];
+}
+
+std::string Repository::branchTip(const std::string& name) {
+    fs::path ref = root_ / "branches" / name;
+    std::error_code ec;
+    if (fs::is_directory(ref, ec)) ref /= ".base";
+    else if (!fs::exists(ref, ec)) return name == currentBranch() ? head() : "";
+    auto lines = readLines(ref);
+    return lines.empty() ? "" : lines[0];
+}
+
+bool Repository::createBranch(const std::string& name) {
+    fs::path ref = root_ / "branches" / name;
+    std::error_code ec;
+    if (fs::exists(ref, ec)) return false;
+    std::string current = currentBranch();
+    std::string tip = branchTip(current);
+    // The current branch gets a ref of its own before head() can move on without it
+    fs::path currentRef = root_ / "branches" / current;
+    if (!tip.empty() && !fs::exists(currentRef, ec)) writeRef(currentRef, tip);
+    return writeRef(ref, tip);
+}
+
+void Repository::materialize(const std::vector<FileChange>& changes, Checkout& result) {
+    trace::Span span("materialize");
+    std::atomic<size_t> written{0}, removed{0};
+    std::vector<char> failed(changes.size(), 0), mismatched(changes.size(), 0);
+    parallelFor(changes.size(), 16, [&](size_t i) {
+        const FileChange& change = changes[i];
+        fs::path target = change.path;
+        std::error_code ec;
+        if (change.newVersion.empty()) {
+            stats::add(stats::StatCalls);
+            if (fs::remove(target, ec)) ++removed;
+            return;
+        }
+        // Readers see the old file or the new one, never a partial copy
+        fs::create_directories(target.parent_path(), ec);
+        fs::path tmp = target.parent_path() / ("." + target.filename().string() + ".checkout");
+        fs::copy_file(change.newVersion, tmp, fs::copy_options::overwrite_existing, ec);
+        if (!ec) fs::rename(tmp, target, ec);
+        struct stat st;
+        if (ec || stat(target.c_str(), &st) != 0) {
+            fs::remove(tmp, ec);
+            failed[i] = 1;
+            return;
+        }
+        stats::add(stats::FilesOpened, 2);
+        stats::add(stats::StatCalls);
+        stats::add(stats::BytesRead, st.st_size);
+        stats::add(stats::BytesWritten, st.st_size);
+        ++written;
+        // What was written is hashed, not taken from the log: a damaged stored version must not
+        // be cached as the content the commit recorded
+        std::string hash = hashFile(target);
+        if (hash != change.newHash) mismatched[i] = 1;
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        hashes_[fs::absolute(target).string()] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim, hash};
+    });
+    result.written += written;
+    result.removed += removed;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (failed[i]) result.failed.push_back(changes[i].path);
+        if (mismatched[i]) result.mismatched.push_back(changes[i].path);
+    }
+}
+
+static std::runtime_error overwriteError(const std::vector<std::string>& paths) {
+    std::string more = paths.size() > 1 ? " and " + std::to_string(paths.size() - 1) + " other file(s)" : "";
+    return std::runtime_error("Uncommitted changes to " + paths[0] + more + " would be overwritten; commit them first");
+}
+
+Repository::Checkout Repository::checkout(const std::string& id, bool force) {
+    trace::Span span("checkout", id);
+    Checkout result;
+    result.commit = id;
+    // Every committed path, with its version at the current branch's tip (old) and at `id` (new)
+    std::vector<FileChange> tree;
+    std::string tip = branchTip(currentBranch());
+    {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        auto p = history_.position.find(id);
+        if (p == history_.position.end()) throw std::runtime_error("Unknown commit " + id);
+        auto t = history_.position.find(tip);
+        size_t current = t == history_.position.end() ? History::npos : t->second;
+        tree.reserve(history_.versions.size());
+        for (const auto& entry : history_.versions) {
+            FileChange change{};
+            change.path = entry.first;
+            if (const History::Version* v = history_.versionAsOf(entry.first, p->second))
+                change.newHash = v->hash, change.newVersion = v->path;
+            if (current != History::npos) {
+                if (const History::Version* v = history_.versionAsOf(entry.first, current))
+                    change.oldHash = v->hash, change.oldVersion = v->path;
+            }
+            tree.push_back(std::move(change));
+        }
+    }
+    std::vector<fs::path> kept;
+    for (const auto& change : tree) {
+        if (!change.newVersion.empty()) kept.push_back(change.path);
+    }
+    // Missing files hash to ""; unchanged ones are answered from the cache without reading them
+    std::vector<std::string> hashes = fileHashes(kept);
+    std::vector<FileChange> toApply;
+    size_t k = 0;
+    for (auto& change : tree) {
+        if (!change.newVersion.empty() && hashes[k++] == change.newHash) ++result.skipped;
+        else toApply.push_back(std::move(change));
+    }
+    if (!force) {
+        std::vector<std::string> dirty = uncommitted(toApply);
+        if (!dirty.empty()) throw overwriteError(dirty);
+    }
+    materialize(toApply, result);
+    return result;
+}
+
+std::vector<std::string> Repository::uncommitted(const std::vector<FileChange>& changes) {
+    std::vector<fs::path> present;
+    std::vector<const FileChange*> checked;
+    std::error_code ec;
+    for (const auto& change : changes) {
+        stats::add(stats::StatCalls);
+        if (!fs::exists(change.path, ec)) continue;
+        present.push_back(change.path);
+        checked.push_back(&change);
+    }
+    std::vector<std::string> result;
+    std::vector<std::string> hashes = fileHashes(present);
+    for (size_t i = 0; i < checked.size(); ++i) {
+        if (hashes[i] != checked[i]->oldHash && hashes[i] != checked[i]->newHash) result.push_back(checked[i]->path);
+    }
+    return result;
+}
+
+Repository::Checkout Repository::switchBranch(const std::string& name) {
+    trace::Span span("switchBranch", name);
+    fs::path ref = root_ / "branches" / name;
+    std::string current = currentBranch();
+    std::error_code ec;
+    if (!fs::exists(ref, ec) && name != current) throw std::runtime_error("Branch '" + name + "' does not exist");
+    Checkout result;
+    if (fs::is_directory(ref, ec)) {
+        // Directory branch: copy its files over the working directory (dotfiles are branch metadata)
+        for (const auto& entry : fs::directory_iterator(ref, ec)) {
+            if (!entry.is_regular_file(ec) || entry.path().filename().string()[0] == '.') continue;
+            copyFile(entry.path(), fs::current_path() / entry.path().filename());
+            ++result.written;
+        }
+        writeText(root_ / ".current_branch", name);
+        return result;
+    }
+
+    std::string from = branchTip(current);
+    result.commit = branchTip(name);
+    if (!from.empty() && resolveCommit(from) != from) from.clear();   // replaced by a pull
+    std::vector<FileChange> toApply;
+    if (!result.commit.empty() && from != result.commit) toApply = changes(from, result.commit);
+    std::vector<std::string> dirty = uncommitted(toApply);
+    if (!dirty.empty()) throw overwriteError(dirty);
+
+    materialize(toApply, result);
+    size_t tracked = 0;
+    if (!result.commit.empty()) {
+        std::lock_guard<std::mutex> lock(historyMutex_);
+        refreshHistory();
+        size_t c = history_.position.at(result.commit);
+        for (const auto& entry : history_.versions) tracked += history_.versionAsOf(entry.first, c) != nullptr;
+    }
+    result.skipped = tracked - std::min(tracked, result.written + result.failed.size());
+
+    fs::path currentRef = root_ / "branches" / current;
+    if (!from.empty() && !fs::exists(currentRef, ec)) writeRef(currentRef, from);
+    writeText(root_ / ".current_branch", name);
+    return result;
+}
+
+// Ref branches: what `theirs` changed since the merge base is brought into the working tree
+Repository::BranchMerge Repository::mergeRefs(const std::string& ours, const std::string& theirs) {
+    if (ours != currentBranch()) throw std::runtime_error("Switch to " + ours + " before merging into it");
+    std::error_code ec;
+    if (!fs::exists(root_ / "branches" / theirs, ec)) throw std::runtime_error("One or both branches do not exist");
+    std::string oursTip = branchTip(ours), theirsTip = branchTip(theirs);
+    BranchMerge result;
+    if (theirsTip.empty()) return result;
+    result.base = mergeBase(oursTip, theirsTip);
+    if (result.base == theirsTip) return result;   // already part of ours
+
+    std::map<std::string, FileChange> oursChanged;
+    if (!oursTip.empty()) {
+        for (auto& change : changes(result.base, oursTip)) oursChanged.emplace(change.path, std::move(change));
+    }
+    std::vector<FileChange> incoming = changes(result.base, theirsTip);
+    std::vector<FileChange> taken;
+    for (const auto& change : incoming) {
+        if (!oursChanged.count(change.path)) taken.push_back(change);
+    }
+    std::vector<std::string> dirty = uncommitted(taken);
+    if (!dirty.empty()) throw overwriteError(dirty);
+
+    result.files.resize(incoming.size());
+    parallelFor(incoming.size(), 4, [&](size_t i) {
+        const FileChange& change = incoming[i];
+        FileMerge& file = result.files[i];
+        file.name = change.path;
+        auto mine = oursChanged.find(change.path);
+        std::error_code ec;
+        if (mine == oursChanged.end()) {
+            // Changed on their side only: take their version
+            if (change.newVersion.empty()) {
+                fs::remove(change.path, ec);
+                return;
+            }
+            fs::create_directories(fs::path(change.path).parent_path(), ec);
+            copyFile(change.newVersion, change.path);
+            file.output = change.path;
+            return;
+        }
+        if (mine->second.newHash == change.newHash) {
+            file.identical = true;
+            return;
+        }
+        trace::Span fileSpan("mergeFile", file.name);
+        std::string baseText, oursText, theirsText;
+        fs::path oursFile = change.path;
+        bool read = (change.oldVersion.empty() || readText(change.oldVersion, baseText)) &&
+                    (!fs::exists(oursFile, ec) || readText(oursFile, oursText)) &&
+                    (change.newVersion.empty() || readText(change.newVersion, theirsText));
+        if (!read) {
+            file.error = "Unable to read " + file.name;
+            return;
+        }
+        file.threeWay = !result.base.empty();
+        MergeResult merged = file.threeWay ? mergeThreeWay(baseText, oursText, theirsText, ours, theirs)
+                                           : mergeTwoWay(oursText, theirsText, ours, theirs);
+        file.conflicts = merged.conflicts;
+        fs::create_directories(oursFile.parent_path(), ec);
+        if (writeText(oursFile, merged.text, std::ios::binary | std::ios::trunc)) file.output = change.path;
+        else file.error = "Unable to write " + change.path;
+    });
+    return result;
+}
+
+Repository::BranchMerge Repository::mergeBranches(const std::string& ours, const std::string& theirs) {
+    trace::Span span("mergeBranches", ours + " " + theirs);
+    fs::path oursPath = root_ / "branches" / ours;
+    fs::path theirsPath = root_ / "branches" / theirs;
+    std::error_code ec;
+    bool oursDirectory = fs::is_directory(oursPath, ec), theirsDirectory = fs::is_directory(theirsPath, ec);
+    if (!oursDirectory && !theirsDirectory) return mergeRefs(ours, theirs);
+    if (!oursDirectory || !theirsDirectory) {
+        bool exists = fs::exists(oursDirectory ? theirsPath : oursPath, ec) || (oursDirectory ? theirs : ours) == currentBranch();
+        throw std::runtime_error(exists ? "Cannot merge a directory branch with a ref branch"
+                                        : "One or both branches do not exist");
+    }
+
+    BranchMerge result;
+    result.base = mergeBase(branchTip(ours), branchTip(theirs));
+    for (const auto& entry : fs::directory_iterator(oursPath, ec)) {
+        std::string name = entry.path().filename().string();
+        stats::add(stats::StatCalls);
+        if (name[0] == '.' || !entry.is_regular_file(ec) || !fs::is_regular_file(theirsPath / name, ec)) continue;
+        FileMerge file{};
+        file.name = name;
+        result.files.push_back(std::move(file));
+    }
+    std::sort(result.files.begin(), result.files.end(),
+              [](const FileMerge& a, const FileMerge& b) { return a.name < b.name; });
+
+    // Equal content needs no merge. Sizes come from stat; only same-size pairs are hashed, and the
+    // stat-keyed hash cache answers for files that have not changed since they were last hashed.
+    std::vector<size_t> sameSize;
+    std::vector<fs::path> toHash;
+    for (size_t i = 0; i < result.files.size(); ++i) {
+        auto a = fs::file_size(oursPath / result.files[i].name, ec);
+        auto b = ec ? 0 : fs::file_size(theirsPath / result.files[i].name, ec);
+        stats::add(stats::StatCalls, 2);
+        if (ec || a != b) continue;
+        sameSize.push_back(i);
+        toHash.push_back(oursPath / result.files[i].name);
+        toHash.push_back(theirsPath / result.files[i].name);
+    }
+    std::vector<std::string> hashes = fileHashes(toHash);
+    for (size_t k = 0; k < sameSize.size(); ++k) {
+        if (!hashes[2 * k].empty() && hashes[2 * k] == hashes[2 * k + 1]) result.files[sameSize[k]].identical = true;
+    }
+
+    // Base versions are looked up before fanning out, so workers only read and write files
+    std::vector<std::string> baseVersions(result.files.size());
+    if (!result.base.empty()) {
+        for (size_t i = 0; i < result.files.size(); ++i) {
+            if (!result.files[i].identical) baseVersions[i] = versionAt(result.files[i].name, result.base);
+        }
+    }
+    parallelFor(result.files.size(), 4, [&](size_t i) {
+        FileMerge& file = result.files[i];
+        if (file.identical) return;
+        trace::Span fileSpan("mergeFile", file.name);
+        std::string oursText, theirsText, baseText;
+        fs::path oursFile = oursPath / file.name, theirsFile = theirsPath / file.name;
+        if (!readText(oursFile, oursText) || !readText(theirsFile, theirsText)) {
+            file.error = "Unable to read " + file.name;
+            return;
+        }
+        file.threeWay = !baseVersions[i].empty() && readText(baseVersions[i], baseText);
+        MergeResult merged = file.threeWay
+            ? mergeThreeWay(baseText, oursText, theirsText, oursFile.string(), theirsFile.string())
+            : mergeTwoWay(oursText, theirsText, oursFile.string(), theirsFile.string());
+        file.conflicts = merged.conflicts;
+        file.output = (oursPath / ("merged_" + file.name)).string();
+        if (!writeText(file.output, merged.text, std::ios::binary | std::ios::trunc)) {
+            file.error = "Unable to write " + file.output;
+            file.output.clear();
+        }
+    });
+    return result;
+}
+
+}  // namespace codekeeper
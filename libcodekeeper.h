@@ -0,0 +1,506 @@
+#pragma once
+
+// libcodekeeper: the repository engine shared by the CLI (codekeeper.cpp) and the web server
+// (codekeeper-web.cpp). It does the work and reports what happened; printing, HTTP status codes
+// and sessions stay in the binaries.
+//
+// Repository::open() hands out one instance per repository directory, so caches (file hashes
+// keyed by stat data, the last commit log line) are shared by everything in the process: every
+// request in codekeeper-web, and every forwarded command in the CLI daemon.
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+namespace codekeeper {
+
+namespace fs = std::filesystem;
+
+// ---- Tracing ----
+// Scoped spans written out as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Collection runs between trace::start() and trace::stop(), which writes the file; while it is
+// off, a Span costs one relaxed atomic load.
+namespace trace {
+
+extern std::atomic<bool> active;
+
+bool start(const std::string& file);   // false if already tracing
+bool startFromEnvironment();           // CODEKEEPER_TRACE=<file>
+void stop();                           // write the trace file and stop collecting
+
+class Span {
+public:
+    explicit Span(const char* name) {
+        if (active.load(std::memory_order_relaxed)) begin(name, nullptr);
+    }
+    // `detail` (a path, a route) is copied only while tracing
+    Span(const char* name, const std::string& detail) {
+        if (active.load(std::memory_order_relaxed)) begin(name, &detail);
+    }
+    ~Span() {
+        if (name_) end();
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    void begin(const char* name, const std::string* detail);
+    void end();
+
+    const char* name_ = nullptr;
+    std::string detail_;
+    int64_t startNanos_ = 0;
+};
+
+}  // namespace trace
+
+// ---- I/O statistics ----
+// Counters kept by the engine's I/O helpers (and the CLI's own file access) for `--stats`. They
+// count only while enabled, so the web server and unflagged commands pay one relaxed load.
+namespace stats {
+
+enum Counter { BytesRead, BytesWritten, FilesOpened, StatCalls, BytesHashed, HashNanos, CounterCount };
+
+extern std::atomic<bool> enabled;
+extern std::atomic<uint64_t> counters[CounterCount];
+
+inline void add(Counter c, uint64_t n = 1) {
+    if (enabled.load(std::memory_order_relaxed)) counters[c].fetch_add(n, std::memory_order_relaxed);
+}
+
+}  // namespace stats
+
+std::string timestamp();
+std::vector<std::string> split(const std::string& str, char delimiter);
+std::string escapeField(const std::string& input);
+std::string hashString(const std::string& input);
+std::string hashFile(const fs::path& filePath);   // SHA-256 hex, "" if unreadable
+
+// Hashes of `files` in order, computed on up to 8 threads; `onHashed(i)` runs (on a worker
+// thread) as each one finishes
+std::vector<std::string> hashFiles(const std::vector<fs::path>& files,
+                                   const std::function<void(size_t)>& onHashed = nullptr);
+
+// Recursively collect regular files from a path (skips hidden, repo, and binary files)
+std::vector<std::string> collectFiles(const std::string& path);
+
+// Live counters for a running commit, read by the web server's job API and metrics
+struct CommitProgress {
+    std::atomic<uint64_t> filesTotal{0};
+    std::atomic<uint64_t> filesHashed{0};
+    std::atomic<uint64_t> bytesStored{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> phaseNanos[4] = {};
+};
+
+enum CommitPhase { PhaseWalk, PhaseHash, PhaseStore, PhaseLogAppend, PhaseCount };
+
+// Live counters for Repository::verify, safe to read from another thread
+struct VerifyProgress {
+    std::atomic<uint64_t> bytesTotal{0};   // commit log bytes this run covers
+    std::atomic<uint64_t> bytesDone{0};
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> versions{0};
+};
+
+// A file uploaded over the web API. Its bytes already sit in versions/, so it is staged by content
+// hash and committing it neither copies nor rehashes anything.
+struct StagedUpload {
+    std::string path;          // absolute working-tree path it will be committed as
+    std::string hash;
+    std::string versionPath;
+};
+
+// ---- Diff ----
+// Line diffs use histogram diff (as in git) over interned lines: common prefix and suffix are
+// trimmed, then the regions are split on their least frequent common lines. Regions where every
+// common line is too frequent fall back to Myers. Lines keep their '\n', so a missing final
+// newline counts as a change.
+
+std::vector<std::string_view> splitLines(std::string_view text);
+
+// a[aStart, aStart + aCount) was replaced by b[bStart, bStart + bCount); either count may be 0
+struct DiffChunk {
+    size_t aStart, aCount;
+    size_t bStart, bCount;
+};
+std::vector<DiffChunk> diffLines(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b);
+
+// Unified diff (diff -u style) of two texts; empty when they are equal
+std::string unifiedDiff(const std::string& aName, std::string_view aText, const std::string& bName,
+                        std::string_view bText, size_t context = 3);
+
+// Two-way merge with no common base: lines only one side has are kept, regions that both sides
+// changed become conflict blocks labelled with the side names
+struct MergeResult {
+    std::string text;
+    size_t conflicts = 0;
+};
+MergeResult mergeTwoWay(std::string_view ours, std::string_view theirs, const std::string& oursLabel,
+                        const std::string& theirsLabel);
+
+// Three-way merge against the common ancestor `base`: a region changed on one side only takes
+// that side, the same change on both sides is taken once, and only regions that both sides
+// changed differently (or changed next to each other) become conflict blocks
+MergeResult mergeThreeWay(std::string_view base, std::string_view ours, std::string_view theirs,
+                          const std::string& oursLabel, const std::string& theirsLabel);
+
+class Repository {
+public:
+    // Shared instance for the repository at `root`
+    static std::shared_ptr<Repository> open(const fs::path& root);
+
+    explicit Repository(fs::path root);
+
+    const fs::path& root() const { return root_; }
+    fs::path logPath() const { return root_ / "commit_log.txt"; }
+    // Where content `hash` is stored when committed as `file`: versions are named by content, so
+    // the same content under the same name is stored once
+    fs::path versionPath(const std::string& hash, const std::string& file) const {
+        return root_ / "versions" / ("version_" + hash + "_" + fs::path(file).filename().string());
+    }
+
+    // True when `file` resolves to a path inside the repository
+    bool contains(const std::string& file) const;
+
+    // Run .pre-commit/.post-commit style hooks; false if the hook exists and failed
+    bool runHook(const std::string& hookName) const;
+
+    // ---- Staging ----
+    // Staged copies live in .staging/<name>; .staging_index remembers the path each was added
+    // from so a commit records the working-tree path rather than the staging copy.
+    struct StageResult {
+        std::vector<std::string> staged;     // absolute source paths
+        std::vector<std::string> rejected;   // outside the repository
+    };
+    StageResult stage(const std::vector<std::string>& paths);
+    std::vector<std::string> unstage(const std::vector<std::string>& paths);   // paths actually unstaged
+    std::vector<std::string> stagedFiles();   // file names, staged copies then uploads
+    std::vector<StagedUpload> stagedUploads() const;
+    void setStagedUploads(const std::vector<StagedUpload>& uploads);
+
+    // ---- Commits ----
+    struct CommitResult {
+        std::string id;
+        std::vector<std::string> files;      // as recorded in the log
+        std::vector<std::string> rejected;   // outside the repository
+        std::vector<std::string> missing;
+        std::vector<std::string> ignored;    // listed in .bypass
+    };
+    // Commit `files` (or the staging area when empty); throws std::runtime_error on failure
+    CommitResult commit(const std::vector<std::string>& files, const std::string& message,
+                        CommitProgress* progress = nullptr);
+
+    // Restore `target` as of commit `commitId`: the version that commit or its nearest ancestor
+    // recorded (see fileAsOf). Without one, the newest commit containing it. Returns the stored
+    // version used, throws std::runtime_error when there is none
+    std::string rollback(const std::string& target, const std::string& commitId = "");
+
+    // Files of the current branch's newest commit whose working copy differs from the stored
+    // version (file names)
+    std::vector<std::string> conflicts();
+
+    std::string lastLogLine();
+
+    // ---- History ----
+    // A commit's parent is recorded at the end of its line as parent=<id> (the ID covers it).
+    // Lines written before branches were refs have no such field: their parent is the commit on
+    // the line before. Commits therefore form a tree that log order lists parents first. Lookups
+    // go through an index that is built on first use and afterwards only reads what has been
+    // appended to the log; ancestry queries take O(log n) steps over per-commit jump pointers.
+    // Newest commit ID in the log, "" when there is none. With branches that may be another
+    // branch's commit: what the working tree was committed from is currentCommit().
+    std::string head();
+    // The current branch's newest commit: branchTip(currentBranch()), or head() when the branch
+    // has none or its ref names a commit a pull replaced
+    std::string currentCommit();
+    std::string currentLogLine();                    // the log line of currentCommit(), "" when none
+    std::string parentOf(const std::string& id);     // "" for a root commit or an unknown ID
+    // Nearest commit that both `a` and `b` are or descend from; "" if either is unknown or none
+    std::string mergeBase(const std::string& a, const std::string& b);
+    // Stored version of the file named `name` as of commit `id`: the one recorded by `id` or by its
+    // nearest ancestor that committed that name; "" if none
+    std::string versionAt(const std::string& name, const std::string& id);
+    // Full ID for a commit ID or an unambiguous prefix of one; "" when none or ambiguous
+    std::string resolveCommit(const std::string& idOrPrefix);
+    // Bumped each time the index starts over because the log was replaced (a pull), also by a
+    // longer log; unchanged while commits are only appended
+    uint64_t historyGeneration();
+    // Stored version from the newest commit in the log that recorded `path`; "" if none did
+    std::string latestVersion(const std::string& path);
+    // ID of the oldest commit whose message is `message`, "" when none
+    std::string commitWithMessage(const std::string& message);
+
+    // ---- Trees ----
+    // The full file tree of each commit as content-addressed directory objects, one per directory:
+    // .trees/objects/<2 hex>/<hash> lists the directory's entries, sorted by name, one per line:
+    //   f|<content hash>|<stored version>|<name>      d|<subtree hash>|<name>
+    // Paths are the recorded absolute paths, so the root tree has "/" as its directory. A commit's
+    // tree is its parent's with only the directories on the way to its files rewritten, so a
+    // commit costs O(files × depth) and unchanged subtrees are shared. .trees/commits maps each
+    // commit ID to its root tree hash; commits without one (made before trees, or pulled) get
+    // theirs built from the nearest ancestor that has one.
+    struct TreeEntry {
+        bool directory = false;
+        std::string hash;      // content hash of a file, or the subtree's hash
+        std::string version;   // stored version of a file
+    };
+    using Tree = std::map<std::string, TreeEntry>;
+    // Root tree hash of commit `id`: equal hashes mean equal trees. Throws std::runtime_error for
+    // an unknown commit.
+    std::string treeOf(const std::string& id);
+    // Entries of directory `dir` (absolute) as of commit `id`: a walk from the root, one object
+    // per path component. Throws std::runtime_error when the commit is unknown or `dir` was not
+    // a directory in it.
+    Tree listTree(const std::string& id, const std::string& dir = "/");
+    // Files commit `id`'s own line recorded, path (as recorded, normalized) -> entry; empty for
+    // an unknown commit
+    Tree committedFiles(const std::string& id);
+
+    // ---- Checkpoints ----
+    // Every K-th commit in log order (K from .checkpoint_interval, default 1000; 0 turns them off)
+    // gets a line in .checkpoints: <position>|<id>|<log offset>|<root tree>. The tree stands for
+    // the commit's full path -> version map, so a record is one line however many files there
+    // are. A lookup as of commit n seeks to the nearest checkpoint at or before n and reads only
+    // the log lines from there to n, instead of the whole log.
+    // `path` (absolute) as of commit `n` in log order (0 = the first): its hash and stored version
+    // from `n` or the nearest ancestor that recorded it; false when none did. Commits in between
+    // that are not ancestors of `n` are skipped. Without a usable checkpoint (none yet, or the log
+    // was replaced by a pull) the history index answers. Throws std::runtime_error when the log
+    // has no commit `n`.
+    bool fileAsOf(const std::string& path, size_t n, TreeEntry& result);
+    // The same for commit `id`, with `path` absolute or relative to the root: any file in the
+    // commit's snapshot, whether or not the commit itself changed it. False for an unknown commit.
+    bool fileAt(const std::string& id, const std::string& path, TreeEntry& result);
+    // A stored version with content hash `hash`, the newest, and the path it was committed
+    // under; false when no commit recorded that content
+    bool versionWithHash(const std::string& hash, std::string& path, TreeEntry& result);
+    // Write .checkpoints afresh for the whole log with the current interval, building any trees
+    // that are missing
+    void rebuildCheckpoints();
+
+    // ---- Commit diffs ----
+    struct FileChange {
+        std::string path;                  // as recorded in the log, normalized
+        std::string oldHash, oldVersion;   // empty when the file did not exist yet
+        std::string newHash, newVersion;   // empty when it does not exist any more (diffing backwards)
+    };
+    // Files whose recorded content differs between commits `from` ("" = before the first commit)
+    // and `to`, by path. Their trees are compared top down, skipping subtrees whose hashes match.
+    // `path`, when given, keeps that file or directory: absolute, or matched against the end of
+    // the recorded paths.
+    std::vector<FileChange> changes(const std::string& from, const std::string& to, const std::string& path = "");
+    // Unified diff of one change from the stored versions ("Binary files ... differ" for binary)
+    std::string diff(const FileChange& change);
+    struct DiffStat {
+        size_t files = 0;
+        size_t added = 0;      // lines
+        size_t removed = 0;
+    };
+    // What commit `id` changed relative to its parent. Computed on first request, then kept in
+    // .diffstats (commit IDs cover their content, so entries never go stale).
+    DiffStat diffStat(const std::string& id);
+
+    // ---- Blame ----
+    struct BlameLine {
+        std::string commit;   // commit that last changed the line
+        std::string text;     // without its newline
+    };
+    struct Blame {
+        std::string path;     // as recorded in the log
+        std::string commit;   // commit whose version was annotated
+        std::vector<BlameLine> lines;
+    };
+    // Annotate `path` (absolute, or the end of one recorded path) as of commit `at` (default: the
+    // current branch's tip) by walking its versions oldest to newest and carrying attributions
+    // through line diffs. Each result is cached in .blame/, and a later blame resumes from the
+    // newest cached version of the path, so one new commit costs one diff. Throws
+    // std::runtime_error when the path was never committed or is ambiguous.
+    Blame blame(const std::string& path, const std::string& at = "");
+
+    // ---- Content ----
+    std::string fileHash(const fs::path& file);
+    // fileHash for many files at once; cache misses are hashed in parallel
+    std::vector<std::string> fileHashes(const std::vector<fs::path>& files, CommitProgress* progress = nullptr);
+    bool sameContent(const fs::path& a, const fs::path& b);
+
+    // ---- Checkout ----
+    struct Checkout {
+        std::string commit;                    // commit the working tree now matches
+        size_t written = 0;                    // files rewritten
+        size_t removed = 0;                    // committed files that `commit` does not have
+        size_t skipped = 0;                    // files that already matched
+        std::vector<std::string> failed;       // could not be written
+        std::vector<std::string> mismatched;   // written, but the stored version differs from the recorded hash
+    };
+    // Make the working tree match commit `id`. Every file the commit has is written unless its
+    // hash (from the stat-keyed cache where the file is unchanged) already matches; files
+    // committed elsewhere in the history that `id` does not have are deleted. Untracked files are
+    // left alone and the current branch stays as it is, so a commit afterwards records the
+    // restored files on it. Unless `force`, refuses (std::runtime_error) when a file it would
+    // write or delete has uncommitted changes: content matching neither the current branch's tip
+    // nor `id`. Throws std::runtime_error for an unknown commit.
+    Checkout checkout(const std::string& id, bool force = false);
+
+    // ---- Verify ----
+    struct Verification {
+        size_t commits = 0;                  // checked by this run
+        size_t versions = 0;                 // stored versions hashed
+        size_t earlier = 0;                  // commits an earlier run had verified and this one skipped
+        size_t problemCount = 0;
+        std::vector<std::string> problems;   // "<commit>: <what>", the first 1000
+    };
+    // Check the commit log: every commit's ID must be the hash of its message, timestamp, parent,
+    // files, hashes and versions; its parent must be an earlier commit; and each stored version
+    // must exist and hash to what the commit recorded. The log is read in batches (at most 256
+    // lines or 64 MiB) whose versions are hashed in parallel, so memory stays bounded apart from
+    // 8 bytes per commit ID seen. The last commit up to which everything checked out is kept in
+    // .verified; unless `full`, a run starts after it, so an interrupted run resumes and a later
+    // one covers only the commits since. Throws std::runtime_error when there is no log.
+    Verification verify(bool full = false, VerifyProgress* progress = nullptr);
+
+    // ---- Branches ----
+    // A branch is a ref: branches/<name> holds the ID of its newest commit, and a commit moves the
+    // current branch's ref to itself. Branches made before refs are directories of file copies
+    // with a .base fork point; they are still listed, switched to and merged the old way.
+    std::vector<std::string> branches() const;
+    std::string currentBranch() const;
+    // Commit a branch points at: its ref, the fork point of a directory branch, or head() for the
+    // current branch before it has a ref; "" if none
+    std::string branchTip(const std::string& name);
+    // branches/<name> pointing at the current branch's tip; false if it already exists
+    bool createBranch(const std::string& name);
+
+    // Make `name` the current branch. Only files whose recorded hash differs between the current
+    // tip and the branch's are rewritten (or removed); the rest are counted as skipped. Throws
+    // std::runtime_error when the branch does not exist or a file to be rewritten has uncommitted
+    // changes.
+    Checkout switchBranch(const std::string& name);
+
+    struct FileMerge {
+        std::string name;          // file name (directory branches) or recorded path (ref branches)
+        std::string output;        // file written; empty when nothing was written
+        bool identical = false;    // same content on both sides: skipped
+        bool threeWay = false;     // merged against its version at the merge base
+        size_t conflicts = 0;      // conflict blocks in the output
+        std::string error;
+    };
+    struct BranchMerge {
+        std::string base;                // merge base, "" when merging two-way
+        std::vector<FileMerge> files;    // by name
+    };
+    // Ref branches: merge `theirs` into the working tree of `ours`, which must be the current
+    // branch. Files `theirs` changed since the merge base are taken, or merged three-way where
+    // `ours` changed them too; the result is left in the working tree to be committed.
+    // Directory branches: merge each file present in both into merged_<name> in `ours`.
+    // Files are merged in parallel; throws std::runtime_error when a branch does not exist.
+    BranchMerge mergeBranches(const std::string& ours, const std::string& theirs);
+
+private:
+    struct StatEntry {
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        std::string value;
+    };
+    static bool unchanged(const StatEntry& e, const struct stat& st);
+
+    // Commit tree and, per file name, the versions committed under it (see History above)
+    struct History {
+        StatEntry log = {};                             // commit log stat when last refreshed
+        off_t indexed = 0;                              // bytes of complete lines read so far
+        std::string tail;                               // the last of those lines
+        std::vector<std::string> ids;                   // log order: parents before children
+        std::vector<off_t> offsets;                     // where each commit's line starts
+        std::vector<size_t> parent;                     // position of the parent, npos for a root
+        std::vector<size_t> depth;                      // commits between it and its root
+        std::vector<size_t> jump;                       // skew-binary jump pointer up the parent chain
+        std::unordered_map<std::string, size_t> position;
+        struct Version {
+            size_t position;
+            std::string hash;
+            std::string path;                           // stored copy
+        };
+        std::unordered_map<std::string, std::vector<Version>> versions;   // recorded path, normalized -> by position
+        std::unordered_map<std::string, std::vector<std::string>> paths;  // file name -> recorded paths
+        std::unordered_map<std::string, std::string> byHash;             // content hash -> recorded path
+        static constexpr size_t npos = static_cast<size_t>(-1);
+        void add(const std::string& id, off_t offset, size_t parentPosition);
+        size_t ancestorAt(size_t c, size_t d) const;      // ancestor of `c` at depth `d`
+        bool isAncestor(size_t a, size_t c) const;        // `a` is `c` or one of its ancestors
+        size_t commonAncestor(size_t a, size_t b) const;  // npos when they share no root
+        // Version of `path` as of commit `c`: recorded by `c` or its nearest ancestor; null if none
+        const Version* versionAsOf(const std::string& path, size_t c) const;
+    };
+    void refreshHistory();   // with historyMutex_ held
+    std::string logLineOf(const std::string& id);   // "" for an unknown commit
+
+    // Trees (see Trees above); with treeMutex_ held
+    std::shared_ptr<const Tree> loadTree(const std::string& hash);
+    std::string storeTree(const Tree& tree);
+    struct TreeUpdate {
+        std::vector<std::string> components;   // path below the root directory
+        TreeEntry file;
+    };
+    // Hash of tree `base` ("" = empty) with the sorted updates [begin, end) applied at `depth`
+    std::string updateTree(const std::string& base, std::vector<TreeUpdate>::const_iterator begin,
+                           std::vector<TreeUpdate>::const_iterator end, size_t depth);
+    bool hasTree(const std::string& id);   // loads .trees/commits on first use
+    std::string treeOfLocked(const std::string& id);
+    void diffTrees(const std::string& a, const std::string& b, const std::string& dir, const std::string& filter,
+                   std::vector<FileChange>& result);
+    // Root tree recorded for `id`, "" if none; the newest line of .trees/commits is checked
+    // before the whole file is loaded, since a new commit's parent is usually on it
+    std::string recordedTree(const std::string& id);
+
+    // Checkpoints (see Checkpoints above); with treeMutex_ held
+    struct Checkpoint {
+        size_t position = 0;
+        std::string id;
+        off_t offset = 0;   // where the commit's line starts in the log
+        std::string tree;
+    };
+    size_t checkpointInterval() const;
+    // Called by commit() for the commit whose line spans [offset, end) in the log. Its position
+    // is carried forward from .checkpoints.tail (<position>|<id>|<offset>|<end> of the previous
+    // commit), so a commit reads no log lines; the history index answers when that does not fit.
+    void addCheckpoint(const std::string& id, off_t offset, off_t end, const std::string& tree);
+    void rebuildCheckpointsLocked();
+
+    // Writes each change's new version over its path (temp file, then rename) or removes the
+    // path when there is none, in parallel; the written files' hashes go into the hash cache
+    void materialize(const std::vector<FileChange>& changes, Checkout& result);
+    // Paths among `changes` whose working copy matches neither side: uncommitted edits
+    std::vector<std::string> uncommitted(const std::vector<FileChange>& changes);
+    BranchMerge mergeRefs(const std::string& ours, const std::string& theirs);
+
+    std::map<std::string, std::string> stagingIndex() const;
+    void saveStagingIndex(const std::map<std::string, std::string>& index) const;
+
+    fs::path root_;
+    std::mutex cacheMutex_;
+    std::map<std::string, StatEntry> hashes_;   // absolute path -> content hash
+    StatEntry lastLine_ = {};                   // commit log stat -> its last line
+    std::mutex historyMutex_;
+    History history_;
+    uint64_t historyGeneration_ = 0;
+    std::mutex diffStatMutex_;
+    bool diffStatsLoaded_ = false;
+    std::unordered_map<std::string, DiffStat> diffStats_;   // .diffstats
+    std::mutex treeMutex_;   // taken before historyMutex_ when both are needed
+    bool treesLoaded_ = false;
+    std::unordered_map<std::string, std::string> commitTrees_;                  // .trees/commits
+    std::unordered_map<std::string, std::shared_ptr<const Tree>> treeCache_;   // bounded, by hash
+};
+
+}  // namespace codekeeper